@@ -0,0 +1,366 @@
+#include "Framebuffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Buffer, drawing state and clip rectangle (inclusive corners)
+static uint16_t *fb_pixels = NULL;
+static uint16_t fb_width = 0;
+static uint16_t fb_height = 0;
+static uint16_t text_color = 0x0000;
+static uint16_t back_color = 0xFFFF;
+static sFONT *text_font = NULL;
+static int16_t clip_x1 = 0, clip_y1 = 0, clip_x2 = -1, clip_y2 = -1;
+
+// Changed lines, empty when dirty_y1 > dirty_y2
+static int16_t dirty_y1 = 0, dirty_y2 = -1;
+
+static uint32_t GlyphLine(const uint8_t *glyph, uint16_t row);
+static void MarkDirty(int16_t y1, int16_t y2);
+static void FillTriangle(int16_t x1, int16_t x2, int16_t x3, int16_t y1, int16_t y2, int16_t y3);
+
+void FB_Init(uint16_t *pixels, uint16_t width, uint16_t height) {
+    fb_pixels = pixels;
+    fb_width = width;
+    fb_height = height;
+    FB_ResetClip();
+    FB_ClearDirty();
+}
+
+uint16_t FB_GetXSize() {
+    return fb_width;
+}
+
+uint16_t FB_GetYSize() {
+    return fb_height;
+}
+
+uint16_t *FB_GetLine(uint16_t y) {
+    return fb_pixels + y * fb_width;
+}
+
+void FB_SetTextColor(uint16_t color) {
+    text_color = color;
+}
+
+void FB_SetBackColor(uint16_t color) {
+    back_color = color;
+}
+
+void FB_SetFont(sFONT *font) {
+    text_font = font;
+}
+
+void FB_SetClip(int16_t x1, int16_t y1, int16_t x2, int16_t y2) {
+    // Drawing is limited to the part of the rectangle inside the buffer
+    clip_x1 = (x1 < 0) ? (0) : (x1);
+    clip_y1 = (y1 < 0) ? (0) : (y1);
+    clip_x2 = (x2 > fb_width - 1) ? (fb_width - 1) : (x2);
+    clip_y2 = (y2 > fb_height - 1) ? (fb_height - 1) : (y2);
+}
+
+void FB_ResetClip() {
+    FB_SetClip(0, 0, fb_width - 1, fb_height - 1);
+}
+
+void FB_Clear(uint16_t color) {
+    for (int y = clip_y1; y <= clip_y2; y++) {
+        uint16_t *line = fb_pixels + y * fb_width;
+        for (int x = clip_x1; x <= clip_x2; x++) {
+            line[x] = color;
+        }
+    }
+    MarkDirty(clip_y1, clip_y2);
+}
+
+void FB_DrawPixel(int16_t x, int16_t y, uint16_t color) {
+    if (x < clip_x1 || x > clip_x2 || y < clip_y1 || y > clip_y2) {
+        return;
+    }
+    fb_pixels[y * fb_width + x] = color;
+    MarkDirty(y, y);
+}
+
+void FB_DrawHLine(int16_t x, int16_t y, uint16_t length) {
+    if (y < clip_y1 || y > clip_y2) {
+        return;
+    }
+    int x1 = (x < clip_x1) ? (clip_x1) : (x);
+    int x2 = (x + length - 1 > clip_x2) ? (clip_x2) : (x + length - 1);
+    uint16_t *line = fb_pixels + y * fb_width;
+    for (int i = x1; i <= x2; i++) {
+        line[i] = text_color;
+    }
+    if (x1 <= x2) {
+        MarkDirty(y, y);
+    }
+}
+
+void FB_DrawVLine(int16_t x, int16_t y, uint16_t length) {
+    for (int i = 0; i < length; i++) {
+        FB_DrawPixel(x, y + i, text_color);
+    }
+}
+
+void FB_DrawLine(int16_t x1, int16_t y1, int16_t x2, int16_t y2) {
+    int16_t deltax = abs(x2 - x1), deltay = abs(y2 - y1);
+    int16_t x = x1, y = y1;
+    int16_t xinc1, xinc2, yinc1, yinc2, den, num, numadd, numpixels;
+
+    xinc1 = xinc2 = (x2 >= x1) ? (1) : (-1);
+    yinc1 = yinc2 = (y2 >= y1) ? (1) : (-1);
+
+    if (deltax >= deltay) {
+        xinc1 = 0;
+        yinc2 = 0;
+        den = deltax;
+        num = deltax / 2;
+        numadd = deltay;
+        numpixels = deltax;
+    } else {
+        xinc2 = 0;
+        yinc1 = 0;
+        den = deltay;
+        num = deltay / 2;
+        numadd = deltax;
+        numpixels = deltay;
+    }
+
+    for (int i = 0; i <= numpixels; i++) {
+        FB_DrawPixel(x, y, text_color);
+        num += numadd;
+        if (num >= den) {
+            num -= den;
+            x += xinc1;
+            y += yinc1;
+        }
+        x += xinc2;
+        y += yinc2;
+    }
+}
+
+void FB_DrawRect(int16_t x, int16_t y, uint16_t width, uint16_t height) {
+    FB_DrawHLine(x, y, width);
+    FB_DrawHLine(x, y + height, width);
+    FB_DrawVLine(x, y, height);
+    FB_DrawVLine(x + width, y, height);
+}
+
+void FB_FillRect(int16_t x, int16_t y, uint16_t width, uint16_t height) {
+    // Unlike BSP_LCD_FillRect(), which fills one more line, exactly height lines are filled
+    for (int i = 0; i < height; i++) {
+        FB_DrawHLine(x, y + i, width);
+    }
+}
+
+void FB_DrawCircle(int16_t x, int16_t y, uint16_t radius) {
+    int32_t decision = 3 - (radius << 1);
+    int16_t current_x = 0, current_y = radius;
+
+    while (current_x <= current_y) {
+        FB_DrawPixel(x + current_x, y - current_y, text_color);
+        FB_DrawPixel(x - current_x, y - current_y, text_color);
+        FB_DrawPixel(x + current_y, y - current_x, text_color);
+        FB_DrawPixel(x - current_y, y - current_x, text_color);
+        FB_DrawPixel(x + current_x, y + current_y, text_color);
+        FB_DrawPixel(x - current_x, y + current_y, text_color);
+        FB_DrawPixel(x + current_y, y + current_x, text_color);
+        FB_DrawPixel(x - current_y, y + current_x, text_color);
+
+        if (decision < 0) {
+            decision += (current_x << 2) + 6;
+        } else {
+            decision += ((current_x - current_y) << 2) + 10;
+            current_y--;
+        }
+        current_x++;
+    }
+}
+
+void FB_FillCircle(int16_t x, int16_t y, uint16_t radius) {
+    int32_t decision = 3 - (radius << 1);
+    int16_t current_x = 0, current_y = radius;
+
+    while (current_x <= current_y) {
+        if (current_y > 0) {
+            FB_DrawHLine(x - current_y, y + current_x, 2 * current_y);
+            FB_DrawHLine(x - current_y, y - current_x, 2 * current_y);
+        }
+        if (current_x > 0) {
+            FB_DrawHLine(x - current_x, y - current_y, 2 * current_x);
+            FB_DrawHLine(x - current_x, y + current_y, 2 * current_x);
+        }
+
+        if (decision < 0) {
+            decision += (current_x << 2) + 6;
+        } else {
+            decision += ((current_x - current_y) << 2) + 10;
+            current_y--;
+        }
+        current_x++;
+    }
+
+    FB_DrawCircle(x, y, radius);
+}
+
+void FB_FillPolygon(const FB_Point *points, uint16_t count) {
+    if (count < 2) {
+        return;
+    }
+
+    // Polygon is filled with triangles from the centre of its bounding box
+    int16_t left = points[0].X, right = points[0].X, top = points[0].Y, bottom = points[0].Y;
+    for (int i = 1; i < count; i++) {
+        left = (points[i].X < left) ? (points[i].X) : (left);
+        right = (points[i].X > right) ? (points[i].X) : (right);
+        top = (points[i].Y < top) ? (points[i].Y) : (top);
+        bottom = (points[i].Y > bottom) ? (points[i].Y) : (bottom);
+    }
+    int16_t x_center = (left + right) / 2, y_center = (bottom + top) / 2;
+
+    int16_t x2 = 0, y2 = 0;
+    for (int i = 0; i < count - 1; i++) {
+        int16_t x = points[i].X, y = points[i].Y;
+        x2 = points[i + 1].X;
+        y2 = points[i + 1].Y;
+        FillTriangle(x, x2, x_center, y, y2, y_center);
+        FillTriangle(x, x_center, x2, y, y_center, y2);
+        FillTriangle(x_center, x2, x, y_center, y2, y);
+    }
+    FillTriangle(points[0].X, x2, x_center, points[0].Y, y2, y_center);
+    FillTriangle(points[0].X, x_center, x2, points[0].Y, y_center, y2);
+    FillTriangle(x_center, x2, points[0].X, y_center, y2, points[0].Y);
+}
+
+void FB_DisplayChar(int16_t x, int16_t y, uint8_t ascii) {
+    uint16_t width = text_font->Width, height = text_font->Height;
+    const uint8_t *glyph = text_font->table + (ascii - ' ') * height * ((width + 7) / 8);
+
+    for (int i = 0; i < height; i++) {
+        uint32_t line = GlyphLine(glyph, i);
+        for (int j = 0; j < width; j++) {
+            FB_DrawPixel(x + j, y + i, (line & (1u << (width - j - 1))) ? (text_color) : (back_color));
+        }
+    }
+}
+
+void FB_DisplayStringAt(int16_t x, int16_t y, const uint8_t *text, FB_LineMode mode) {
+    // Same placement as BSP_LCD_DisplayStringAt(), text never starts before column 1
+    uint16_t refcolumn;
+    uint32_t size = strlen((const char *)text);
+    uint32_t xsize = fb_width / text_font->Width;
+
+    if (mode == FB_CENTER_MODE) {
+        refcolumn = x + ((xsize - size) * text_font->Width) / 2;
+    } else if (mode == FB_RIGHT_MODE) {
+        refcolumn = -x + ((xsize - size) * text_font->Width);
+    } else {
+        refcolumn = x;
+    }
+    if (refcolumn < 1 || refcolumn >= 0x8000) {
+        refcolumn = 1;
+    }
+
+    for (int i = 0; *text != 0 && ((fb_width - i * text_font->Width) & 0xFFFF) >= text_font->Width; i++) {
+        FB_DisplayChar(refcolumn, y, *text++);
+        refcolumn += text_font->Width;
+    }
+}
+
+void FB_RenderChar(uint8_t ascii, uint16_t *pixels) {
+    // Same pixels FB_DisplayChar() would draw, row after row
+    uint16_t width = text_font->Width, height = text_font->Height;
+    const uint8_t *glyph = text_font->table + (ascii - ' ') * height * ((width + 7) / 8);
+
+    for (int i = 0; i < height; i++) {
+        uint32_t line = GlyphLine(glyph, i);
+        for (int j = 0; j < width; j++) {
+            *pixels++ = (line & (1u << (width - j - 1))) ? (text_color) : (back_color);
+        }
+    }
+}
+
+void FB_DrawImage(int16_t x, int16_t y, uint16_t width, uint16_t height, const uint16_t *pixels) {
+    int x1 = (x < clip_x1) ? (clip_x1) : (x);
+    int x2 = (x + width - 1 > clip_x2) ? (clip_x2) : (x + width - 1);
+    int y1 = (y < clip_y1) ? (clip_y1) : (y);
+    int y2 = (y + height - 1 > clip_y2) ? (clip_y2) : (y + height - 1);
+    if (x1 > x2 || y1 > y2) {
+        return;
+    }
+
+    for (int i = y1; i <= y2; i++) {
+        memcpy(fb_pixels + i * fb_width + x1, pixels + (i - y) * width + (x1 - x), (x2 - x1 + 1) * sizeof(uint16_t));
+    }
+    MarkDirty(y1, y2);
+}
+
+bool FB_GetDirtyLines(int16_t *y1, int16_t *y2) {
+    *y1 = dirty_y1;
+    *y2 = dirty_y2;
+    return dirty_y1 <= dirty_y2;
+}
+
+void FB_ClearDirty() {
+    dirty_y1 = fb_height;
+    dirty_y2 = -1;
+}
+
+static uint32_t GlyphLine(const uint8_t *glyph, uint16_t row) {
+    // Every row of a glyph takes (width + 7) / 8 bytes, most significant bit
+    // first, the unused low bits of the last byte are dropped
+    uint16_t width = text_font->Width;
+    uint16_t row_bytes = (width + 7) / 8;
+    const uint8_t *bytes = glyph + row_bytes * row;
+    uint32_t line;
+    if (row_bytes == 1) {
+        line = bytes[0];
+    } else if (row_bytes == 2) {
+        line = (bytes[0] << 8) | bytes[1];
+    } else {
+        line = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+    }
+    return line >> (8 * row_bytes - width);
+}
+
+static void MarkDirty(int16_t y1, int16_t y2) {
+    dirty_y1 = (y1 < dirty_y1) ? (y1) : (dirty_y1);
+    dirty_y2 = (y2 > dirty_y2) ? (y2) : (dirty_y2);
+}
+
+static void FillTriangle(int16_t x1, int16_t x2, int16_t x3, int16_t y1, int16_t y2, int16_t y3) {
+    // Lines from every point of the first side to the third corner
+    int16_t deltax = abs(x2 - x1), deltay = abs(y2 - y1);
+    int16_t x = x1, y = y1;
+    int16_t xinc1, xinc2, yinc1, yinc2, den, num, numadd, numpixels;
+
+    xinc1 = xinc2 = (x2 >= x1) ? (1) : (-1);
+    yinc1 = yinc2 = (y2 >= y1) ? (1) : (-1);
+
+    if (deltax >= deltay) {
+        xinc1 = 0;
+        yinc2 = 0;
+        den = deltax;
+        num = deltax / 2;
+        numadd = deltay;
+        numpixels = deltax;
+    } else {
+        xinc2 = 0;
+        yinc1 = 0;
+        den = deltay;
+        num = deltay / 2;
+        numadd = deltax;
+        numpixels = deltay;
+    }
+
+    for (int i = 0; i <= numpixels; i++) {
+        FB_DrawLine(x, y, x3, y3);
+        num += numadd;
+        if (num >= den) {
+            num -= den;
+            x += xinc1;
+            y += yinc1;
+        }
+        x += xinc2;
+        y += yinc2;
+    }
+}
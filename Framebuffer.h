@@ -0,0 +1,59 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+#include "fonts.h"
+
+// RGB565 frame kept in RAM. Drawing functions follow the same steps as the
+// matching BSP_LCD_* functions, so a frame drawn here looks like one drawn
+// straight to the LCD. Lines changed since the last flush are tracked,
+// so that only they have to be sent to the LCD.
+
+typedef enum {
+    FB_CENTER_MODE = 0x01,
+    FB_RIGHT_MODE = 0x02,
+    FB_LEFT_MODE = 0x03
+} FB_LineMode;
+
+typedef struct {
+    int16_t X;
+    int16_t Y;
+} FB_Point;
+
+// Buffer and size
+void FB_Init(uint16_t *pixels, uint16_t width, uint16_t height);
+uint16_t FB_GetXSize();
+uint16_t FB_GetYSize();
+uint16_t *FB_GetLine(uint16_t y);
+
+// Drawing state
+void FB_SetTextColor(uint16_t color);
+void FB_SetBackColor(uint16_t color);
+void FB_SetFont(sFONT *font);
+void FB_SetClip(int16_t x1, int16_t y1, int16_t x2, int16_t y2);
+void FB_ResetClip();
+
+// Drawing functions
+void FB_Clear(uint16_t color);
+void FB_DrawPixel(int16_t x, int16_t y, uint16_t color);
+void FB_DrawHLine(int16_t x, int16_t y, uint16_t length);
+void FB_DrawVLine(int16_t x, int16_t y, uint16_t length);
+void FB_DrawLine(int16_t x1, int16_t y1, int16_t x2, int16_t y2);
+void FB_DrawRect(int16_t x, int16_t y, uint16_t width, uint16_t height);
+void FB_FillRect(int16_t x, int16_t y, uint16_t width, uint16_t height);
+void FB_DrawCircle(int16_t x, int16_t y, uint16_t radius);
+void FB_FillCircle(int16_t x, int16_t y, uint16_t radius);
+void FB_FillPolygon(const FB_Point *points, uint16_t count);
+void FB_DisplayChar(int16_t x, int16_t y, uint8_t ascii);
+void FB_DisplayStringAt(int16_t x, int16_t y, const uint8_t *text, FB_LineMode mode);
+
+// Pre-rasterized images: a glyph of the current font in the current colors
+// (Width * Height pixels) and a copy of such an image into the frame
+void FB_RenderChar(uint8_t ascii, uint16_t *pixels);
+void FB_DrawImage(int16_t x, int16_t y, uint16_t width, uint16_t height, const uint16_t *pixels);
+
+// Lines changed since the last call to FB_ClearDirty()
+bool FB_GetDirtyLines(int16_t *y1, int16_t *y2);
+void FB_ClearDirty();
+
+#endif
@@ -0,0 +1,398 @@
+#include "mbed.h"
+#include "easy-connect.h"
+#include "MQTTNetwork.h"
+#include "MQTTmbed.h"
+#include "MQTTClient.h"
+#include "Random.h"
+#include "Network.h"
+
+#define BROKERHOST "broker.hivemq.com"
+#define BROKERPORT 1883
+#define LOBBYTOPIC "planarity/lobby"
+// Topic a player of a match publishes on, the opponent subscribes to it
+#define MATCHTOPIC "planarity/match/%08lx/%s"
+#define TOPICSIZE 40
+// Random stream of the match IDs, the game uses the lower ones
+#define MATCHSTREAM 3
+// The network thread sends queued messages at least this often
+#define NETYIELDMS 10
+// Above the game thread, so a message is taken off the socket as soon as it arrives
+#define NETPRIORITY osPriorityAboveNormal
+#define NETSTACKSIZE 6144
+#define NETQUEUESIZE 16
+#define NETMESSAGESIZE 24
+// Graph sync messages: first byte, format version and sizes
+#define GRAPHMESSAGE 'G'
+#define GRAPHACKMESSAGE 'A'
+#define GRAPHSYNCVERSION 2
+#define GRAPHMESSAGESIZE 13
+#define GRAPHACKSIZE 5
+
+// Ring buffer with one producer and one consumer thread. Each index is only
+// written by one side, the barrier makes the slot visible before the index.
+template <class T, int N>
+struct SpscQueue {
+    T items[N];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+};
+
+template <class T, int N>
+static bool QueuePush(SpscQueue<T, N> *queue, const T &item) {
+    uint32_t tail = queue->tail;
+    if (tail - queue->head == N) {
+        return false;
+    }
+    queue->items[tail % N] = item;
+    __sync_synchronize();
+    queue->tail = tail + 1;
+    return true;
+}
+
+template <class T, int N>
+static bool QueuePop(SpscQueue<T, N> *queue, T *item) {
+    uint32_t head = queue->head;
+    if (head == queue->tail) {
+        return false;
+    }
+    __sync_synchronize();
+    *item = queue->items[head % N];
+    __sync_synchronize();
+    queue->head = head + 1;
+    return true;
+}
+
+typedef enum {
+    SEND_LOBBY,
+    SEND_MATCH,
+    ENTER_MATCH
+} NetMessageKind;
+
+// Message to publish or, for ENTER_MATCH, the match to subscribe to
+struct NetMessage {
+    uint8_t kind;
+    uint8_t length;
+    uint8_t payload[NETMESSAGESIZE];
+    uint32_t match;
+    bool host;
+};
+
+// Text of the signals, indexed by NetEventType
+static const char *signals[] = {"Join", "Host", "JoinReady", "HostReady", "JoinWon", "HostWon", "JoinAck"};
+#define NUMOFSIGNALS 7
+
+// Events for the game thread and messages for the network thread
+static SpscQueue<NetEvent, NETQUEUESIZE> events;
+static SpscQueue<NetMessage, NETQUEUESIZE> outgoing;
+
+// Client ID and topics of the current match, only the network thread
+// changes the subscriptions
+static uint32_t device_id = 0;
+static char client_id[TOPICSIZE];
+static char match_publish[TOPICSIZE];
+static char match_subscribe[TOPICSIZE];
+static bool in_match = false;
+static Random match_random;
+
+static MQTTNetwork *mqtt_network = NULL;
+static MQTT::Client<MQTTNetwork, Countdown> *client = NULL;
+static Thread *network_thread = NULL;
+static volatile bool running = false;
+static void (*notify_game)() = NULL;
+
+static void NetworkTask();
+static void EnterMatch(uint32_t match, bool host);
+static void MessageArrived(MQTT::MessageData& md);
+static bool ParseHex(const uint8_t *text, uint32_t *value);
+static void PostEvent(const NetEvent &event);
+static bool Send(uint8_t kind, const uint8_t *payload, int length);
+static uint16_t Checksum(const uint8_t *data, int length);
+static void PutUint16(uint8_t *p, uint16_t value);
+static uint16_t GetUint16(const uint8_t *p);
+
+void NetStart(void (*notify)()) {
+    events.head = events.tail = 0;
+    outgoing.head = outgoing.tail = 0;
+    notify_game = notify;
+    in_match = false;
+    
+    // FNV-1a of the 96 bit unique ID, the time makes match IDs differ between runs
+    uint32_t uid[3] = {HAL_GetUIDw0(), HAL_GetUIDw1(), HAL_GetUIDw2()};
+    device_id = 2166136261u;
+    for (int i = 0; i < 12; i++) {
+        device_id = (device_id ^ ((uid[i / 4] >> (8 * (i % 4))) & 0xFF)) * 16777619u;
+    }
+    sprintf(client_id, "planarity-%08lx", (unsigned long)device_id);
+    RandomSeed(&match_random, device_id ^ us_ticker_read(), MATCHSTREAM);
+
+    // Setup connection
+    NetworkInterface *network;
+    network = NetworkInterface::get_default_instance();
+    mqtt_network = new MQTTNetwork(network);
+    client = new MQTT::Client<MQTTNetwork, Countdown>(*mqtt_network);
+    int rc = mqtt_network->connect(BROKERHOST, BROKERPORT);
+    if (rc != 0) {
+        printf("rc from TCP connect is %d\r\n", rc);
+    }
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.MQTTVersion = 3;
+    data.clientID.cstring = (char *)client_id;
+    data.username.cstring = (char *)"";
+    data.password.cstring = (char *)"";
+    if ((rc = client->connect(data)) != 0) {
+        printf("rc from MQTT connect is %d\r\n", rc);
+    }
+
+    // The handler tells the lobby and match messages apart by their contents
+    if ((rc = client->subscribe(LOBBYTOPIC, MQTT::QOS0, MessageArrived)) != 0) {
+        printf("rc from MQTT subscribe is %d\r\n", rc);
+    }
+
+    running = true;
+    network_thread = new Thread(NETPRIORITY, NETSTACKSIZE);
+    network_thread->start(NetworkTask);
+}
+
+void NetStop() {
+    if (network_thread == NULL) {
+        return;
+    }
+
+    running = false;
+    network_thread->join();
+    delete network_thread;
+    network_thread = NULL;
+
+    client->disconnect();
+    mqtt_network->disconnect();
+    delete client;
+    delete mqtt_network;
+    client = NULL;
+    mqtt_network = NULL;
+}
+
+bool NetPoll(NetEvent *event) {
+    return QueuePop(&events, event);
+}
+
+uint32_t NetDeviceId() {
+    return device_id;
+}
+
+uint32_t NetNewMatchId() {
+    // Match ID 0 means no match
+    uint32_t match;
+    do {
+        match = RandomNext(&match_random);
+    } while (match == 0);
+    return match;
+}
+
+// Lobby messages: "Join <device>" and "Host <device> <match>", both numbers
+// with 8 hexadecimal digits
+bool NetSendJoinRequest() {
+    char text[NETMESSAGESIZE];
+    int length = sprintf(text, "Join %08lx", (unsigned long)device_id);
+    return Send(SEND_LOBBY, (const uint8_t *)text, length);
+}
+
+bool NetSendHostOffer(uint32_t device, uint32_t match) {
+    char text[NETMESSAGESIZE];
+    int length = sprintf(text, "Host %08lx %08lx", (unsigned long)device, (unsigned long)match);
+    return Send(SEND_LOBBY, (const uint8_t *)text, length);
+}
+
+bool NetEnterMatch(uint32_t match, bool host) {
+    NetMessage message;
+    message.kind = ENTER_MATCH;
+    message.length = 0;
+    message.match = match;
+    message.host = host;
+    return QueuePush(&outgoing, message);
+}
+
+bool NetSendSignal(uint8_t type) {
+    if (type >= NUMOFSIGNALS) {
+        return false;
+    }
+    return Send(SEND_MATCH, (const uint8_t *)signals[type], strlen(signals[type]));
+}
+
+// Graph message, numbers are little endian. Both players make the graph
+// from the same seed, so only the seed and the number of lines are sent:
+//   0  'G'                      1  format version
+//   2  sequence number          4  length of the whole message
+//   6  puzzle seed              10 number of lines
+//   11 checksum of everything before it
+bool NetSendGraph(uint16_t seq, uint32_t seed, uint8_t lines) {
+    uint8_t buffer[GRAPHMESSAGESIZE];
+    buffer[0] = GRAPHMESSAGE;
+    buffer[1] = GRAPHSYNCVERSION;
+    PutUint16(buffer + 2, seq);
+    PutUint16(buffer + 4, GRAPHMESSAGESIZE);
+    PutUint16(buffer + 6, seed & 0xFFFF);
+    PutUint16(buffer + 8, seed >> 16);
+    buffer[10] = lines;
+    PutUint16(buffer + 11, Checksum(buffer, GRAPHMESSAGESIZE - 2));
+    return Send(SEND_MATCH, buffer, GRAPHMESSAGESIZE);
+}
+
+bool NetSendGraphAck(uint16_t seq, uint8_t status) {
+    // 'A', version, sequence number of the graph and status
+    uint8_t buffer[GRAPHACKSIZE] = {GRAPHACKMESSAGE, GRAPHSYNCVERSION};
+    PutUint16(buffer + 2, seq);
+    buffer[4] = status;
+    return Send(SEND_MATCH, buffer, GRAPHACKSIZE);
+}
+
+static void NetworkTask() {
+    while (running) {
+        NetMessage queued;
+        while (QueuePop(&outgoing, &queued)) {
+            if (queued.kind == ENTER_MATCH) {
+                EnterMatch(queued.match, queued.host);
+                continue;
+            }
+            
+            // Match messages sent outside of a match have nowhere to go
+            const char *topic = (queued.kind == SEND_LOBBY) ? (LOBBYTOPIC) : (match_publish);
+            if (queued.kind == SEND_MATCH && !in_match) {
+                continue;
+            }
+            MQTT::Message message;
+            message.qos = MQTT::QOS0;
+            message.retained = false;
+            message.dup = false;
+            message.payload = (void*)queued.payload;
+            message.payloadlen = queued.length;
+            client->publish(topic, message);
+        }
+
+        // Arriving messages are handed to MessageArrived() from here
+        client->yield(NETYIELDMS);
+    }
+}
+
+static void EnterMatch(uint32_t match, bool host) {
+    if (in_match) {
+        client->unsubscribe(match_subscribe);
+        in_match = false;
+    }
+    if (match == 0) {
+        return;
+    }
+    
+    sprintf(match_publish, MATCHTOPIC, (unsigned long)match, (host) ? ("host") : ("join"));
+    sprintf(match_subscribe, MATCHTOPIC, (unsigned long)match, (host) ? ("join") : ("host"));
+    int rc = client->subscribe(match_subscribe, MQTT::QOS0, MessageArrived);
+    if (rc != 0) {
+        printf("rc from MQTT subscribe is %d\r\n", rc);
+    }
+    in_match = true;
+}
+
+static void MessageArrived(MQTT::MessageData& md) {
+    MQTT::Message &message = md.message;
+    const uint8_t *data = (const uint8_t *)message.payload;
+    int length = message.payloadlen;
+    NetEvent event = {0, 0, 0, 0, 0, 0, 0};
+
+    if (length == GRAPHMESSAGESIZE && data[0] == GRAPHMESSAGE) {
+        // A damaged graph still carries the sequence number to reject
+        event.seq = GetUint16(data + 2);
+        if (data[1] != GRAPHSYNCVERSION || GetUint16(data + 4) != length ||
+            GetUint16(data + length - 2) != Checksum(data, length - 2)) {
+            event.type = NET_GRAPH_DAMAGED;
+        } else {
+            event.type = NET_GRAPH;
+            event.seed = GetUint16(data + 6) | ((uint32_t)GetUint16(data + 8) << 16);
+            event.lines = data[10];
+        }
+        PostEvent(event);
+        return;
+    }
+
+    if (length == GRAPHACKSIZE && data[0] == GRAPHACKMESSAGE && data[1] == GRAPHSYNCVERSION) {
+        event.type = NET_GRAPH_ACK;
+        event.seq = GetUint16(data + 2);
+        event.status = data[4];
+        PostEvent(event);
+        return;
+    }
+
+    if (length == 13 && !strncmp((const char *)data, "Join ", 5) && ParseHex(data + 5, &event.device)) {
+        event.type = NET_JOIN_REQUEST;
+        PostEvent(event);
+        return;
+    }
+    
+    if (length == 22 && !strncmp((const char *)data, "Host ", 5) && ParseHex(data + 5, &event.device) &&
+        data[13] == ' ' && ParseHex(data + 14, &event.match)) {
+        event.type = NET_HOST_OFFER;
+        PostEvent(event);
+        return;
+    }
+    
+    for (int i = 0; i < NUMOFSIGNALS; i++) {
+        if (length == (int)strlen(signals[i]) && !strncmp((const char *)data, signals[i], length)) {
+            event.type = i;
+            PostEvent(event);
+            return;
+        }
+    }
+}
+
+static bool ParseHex(const uint8_t *text, uint32_t *value) {
+    // Exactly 8 digits
+    *value = 0;
+    for (int i = 0; i < 8; i++) {
+        uint8_t c = text[i];
+        int digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        *value = (*value << 4) | digit;
+    }
+    return true;
+}
+
+static void PostEvent(const NetEvent &event) {
+    // A full queue means the game thread stopped reading, the event is lost
+    // like a message on a dropped connection
+    if (QueuePush(&events, event) && notify_game != NULL) {
+        notify_game();
+    }
+}
+
+static bool Send(uint8_t kind, const uint8_t *payload, int length) {
+    NetMessage message;
+    message.kind = kind;
+    message.length = length;
+    memcpy(message.payload, payload, length);
+    return QueuePush(&outgoing, message);
+}
+
+static uint16_t Checksum(const uint8_t *data, int length) {
+    // Fletcher-16
+    uint16_t sum1 = 0, sum2 = 0;
+    for (int i = 0; i < length; i++) {
+        sum1 = (sum1 + data[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+static void PutUint16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static uint16_t GetUint16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
@@ -0,0 +1,60 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <stdint.h>
+
+// Multiplayer messages over MQTT. A network thread owns the connection: it
+// sends the messages the game queued and decodes arriving ones into
+// NetEvents. Both queues have one producer and one consumer, so neither
+// thread ever waits for the other. The notify function given to NetStart()
+// is called by the network thread after it queued an event.
+//
+// Players meet in the lobby: a joiner asks for a match, a host offers one
+// with a new match ID and both move to the topics of that match, where all
+// other messages go. The client ID comes from the unique ID of the chip, so
+// any number of boards can share the broker.
+
+typedef enum {
+    NET_JOIN,
+    NET_HOST,
+    NET_JOIN_READY,
+    NET_HOST_READY,
+    NET_JOIN_WON,
+    NET_HOST_WON,
+    NET_JOIN_ACK,
+    NET_GRAPH,
+    NET_GRAPH_DAMAGED,
+    NET_GRAPH_ACK,
+    NET_JOIN_REQUEST,
+    NET_HOST_OFFER
+} NetEventType;
+
+struct NetEvent {
+    uint8_t type;
+    uint8_t lines;
+    uint8_t status;
+    uint16_t seq;
+    uint32_t seed;
+    // Device that asked for a match or that a match is offered to
+    uint32_t device;
+    uint32_t match;
+};
+
+void NetStart(void (*notify)());
+void NetStop();
+bool NetPoll(NetEvent *event);
+uint32_t NetDeviceId();
+uint32_t NetNewMatchId();
+
+// Lobby messages, NetEnterMatch() with match ID 0 leaves the current match
+bool NetSendJoinRequest();
+bool NetSendHostOffer(uint32_t device, uint32_t match);
+bool NetEnterMatch(uint32_t match, bool host);
+
+// Signals are NET_JOIN up to NET_JOIN_ACK, a graph acknowledgement has
+// status 0 when the graph was loaded and 1 when it has to be sent again
+bool NetSendSignal(uint8_t type);
+bool NetSendGraph(uint16_t seq, uint32_t seed, uint8_t lines);
+bool NetSendGraphAck(uint16_t seq, uint8_t status);
+
+#endif
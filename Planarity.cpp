@@ -1,22 +1,192 @@
 #include "mbed.h"
 #include "stm32f413h_discovery_ts.h"
 #include "stm32f413h_discovery_lcd.h"
-#include "easy-connect.h"
-#include "MQTTNetwork.h"
-#include "MQTTmbed.h"
-#include "MQTTClient.h"
+#include "Framebuffer.h"
+#include "Touch.h"
+#include "Network.h"
+#include "Random.h"
+#include "Solver.h"
+#include "Predicates.h"
+#include <math.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-#define NUMOFNODES 6
-#define MAXNUMOFEDGES 12
 #define NUMOFTHEMES 4
 #define NUMOFPLAYERS 5
-#define EPSILON 0.00001
+// Level n is made of LEVELLINES + n lines, larger values make large puzzles (tests)
+#ifndef LEVELLINES
+#define LEVELLINES 3
+#endif
+#define NORMALLEVEL 2
+#define NUMOFLEVELS 3
+// Ready puzzles kept for every level
+#define POOLSIZE 3
+// Random layouts tried before a puzzle with no crossings is accepted
+#define SCRAMBLETRIES 32
+// Without vector instructions crossings of this many edges are counted with a sweep
+#define SWEEPTHRESHOLD 64
+// IntersectBatch() keeps orientations in 32-bit lanes, which cannot overflow
+// while coordinates stay within +-BATCHRANGE, other segments take the scalar test
+#define BATCHRANGE 16383
+// The grid has GRIDSIZE by GRIDSIZE cells of at least GRIDCELLSIZE world
+// units, larger worlds get larger cells
+#define GRIDSIZE 8
+#define GRIDCELLSIZE 30
+#define NODERADIUS 5
+// A touch picks the nearest node drawn within TOUCHRADIUS pixels of it, a
+// finger covers more than the circle of a node
+#ifndef TOUCHRADIUS
+#define TOUCHRADIUS 8
+#endif
+#define SCREENSIZE 240
+// Part of the screen the graph is drawn in, below the HUD and the buttons
+#define VIEWX1 0
+#define VIEWY1 36
+#define VIEWX2 239
+#define VIEWY2 239
+// Pinching zooms in up to VIEWMAXSCALE times and out until the whole world
+// fits, below LODSCALE nodes are drawn as squares LODRADIUS pixels around them
+#define VIEWMAXSCALE 4.0f
+#define LODSCALE 0.5f
+#define LODRADIUS 2
+// Fingers closer than this do not zoom, their distance is too noisy
+#define PINCHMINDISTANCE 20.0f
+// Puzzles with more nodes get a world larger than the play area, so that
+// their nodes are as far apart as in the hardest level
+#define WORLDNODES 15
+// Line the game screens show their messages on
+#define STATUSY 227
+// Refresh period of the LCD, a drag is drawn at most once per period
+#define FRAMEPERIODUS 16667
+// Characters of every HUD value and the Font12 glyphs kept for them
+#define HUDFIELDLENGTH 5
+#define HUDGLYPHS "0123456789-s "
+#define HUDGLYPHCOUNT 13
+#define HUDGLYPHWIDTH 7
+#define HUDGLYPHHEIGHT 12
+// A hint search runs for at most HINTSLICEUS between two touch checks and
+// shows the best move found after HINTBUDGETUS. Nodes are tried at their
+// place in the solution and on a grid of HINTCOLUMNS by HINTROWS positions
+// spread over the world, 10 pixels apart in the play area.
+#define HINTSLICEUS 8000
+#define HINTBUDGETUS 250000
+#define HINTCOLUMNS 23
+#define HINTROWS 19
+// Outcome of a hint search on the status line, long enough for any int
+// in "Marked move removes <n> crossings"
+#define HINTSTATUSLENGTH 42
+// Time after which an unacknowledged graph or match confirmation is sent
+// again, the match is given up after GRAPHSENDS sends (a joiner waiting for
+// the graph waits one period longer)
+#define GRAPHRESENDMS 1000
+#define GRAPHSENDS 5
+// A joiner asks for a match again after LOBBYRETRYMS, a host gives up an
+// offered match when no joiner confirmed it within LOBBYOFFERMS
+#define LOBBYRETRYMS 1000
+#define LOBBYOFFERMS 3000
+// A host waits up to LOBBYJITTERMS before it offers a match to a joiner and
+// gives up when another host's offer reaches the joiner first. It remembers
+// LOBBYJOINERS joiners, those that did not ask again for two retry periods
+// are forgotten.
+#define LOBBYJITTERMS 400
+#define LOBBYJOINERS 8
+// Random number streams of puzzle generation and of Crazy mode moves
+#define PUZZLESTREAM 1
+#define CRAZYSTREAM 2
+// Every puzzle is made from this seed when it is not 0 (benchmarks, tests)
+#ifndef PUZZLESEED
+#define PUZZLESEED 0
+#endif
+// Drag, hint search and match setup timing is printed when this is not 0
+// (profiling, the load test needs it)
+#ifndef PROFILE
+#define PROFILE 0
+#endif
 
-TS_StateTypeDef TS_State = { 0 };
+// Graph with node coordinates and edges (pairs of node indices) kept in separate arrays
+struct Graph {
+    int num_of_nodes;
+    int num_of_edges;
+    int16_t *x;
+    int16_t *y;
+    uint16_t *node1;
+    uint16_t *node2;
+};
+
+struct LinePoint {
+    double position;
+    int node;
+};
+
+struct GridRange {
+    uint8_t x1;
+    uint8_t y1;
+    uint8_t x2;
+    uint8_t y2;
+};
+
+// Rectangle with inclusive corners, on the screen or in the world
+struct ScreenRect {
+    int16_t x1;
+    int16_t y1;
+    int16_t x2;
+    int16_t y2;
+};
+
+// Mapping of world coordinates (the ones of the nodes) to the screen: world
+// point (x, y) is drawn at (VIEWX1, VIEWY1) and one world unit takes scale
+// pixels. At min_scale the whole world fits into the view.
+struct Viewport {
+    float scale;
+    float min_scale;
+    float x;
+    float y;
+    ScreenRect world;
+};
 
-struct Edge {
-    pPoint point1;
-    pPoint point2;
+// Value shown after the label of one HUD line and the characters of it
+// that are on the screen now
+struct HudField {
+    int16_t x;
+    int16_t y;
+    char suffix;
+    char shown[HUDFIELDLENGTH];
+};
+
+// State of the hint search: nodes with crossings in hint_order, the next
+// candidate position and the best move found so far
+struct HintSearch {
+    bool active;
+    bool shown;
+    uint32_t start_us;
+    int num_of_nodes;
+    int order_index;
+    int candidate;
+    int scored;
+    int slices;
+    int best_node;
+    int16_t best_x;
+    int16_t best_y;
+    int best_gain;
+};
+
+// Generated puzzle waiting in the pool, with the seed it was made from
+struct Puzzle {
+    uint32_t seed;
+    Graph graph;
+    int16_t *solution_x;
+    int16_t *solution_y;
+    bool solution_found;
+};
+
+enum HudFieldIndex {
+    HUD_CROSSINGS,
+    HUD_MOVES,
+    HUD_TIME,
+    NUMOFHUDFIELDS
 };
 
 struct Theme {
@@ -37,33 +207,157 @@ struct PlayerHighscore {
 int theme_selected = 0;
 int num_of_moves = 0;
 int t = 1;
-int join_received = 0;
-int num_of_edges = 0;
 int current_player = 0;
 
 Ticker ticker, ticker2;
 
+// Events posted by the tickers and how many of them the main thread has
+// handled, every counter has only one writer so no locking is needed
+enum TimerEvent {
+    TIMER_CLASSIC,
+    TIMER_RACE_AGAINST_TIME,
+    TIMER_RANDOM_NODE,
+    NUMOFTIMEREVENTS
+};
+volatile uint32_t timer_events_posted[NUMOFTIMEREVENTS] = {0};
+uint32_t timer_events_handled[NUMOFTIMEREVENTS] = {0};
+
 bool go_to_ready = false;
 bool start_host = false;
 bool start_join = false;
 bool lost = false;
 bool host_join = false;
 
+// Match offered by the host or accepted by the joiner (0 while in the lobby)
+// and time of the last lobby message
+uint32_t match_id = 0;
+uint32_t lobby_us = 0;
+
+// Confirmation of the match: the joiner sends Join until the host answers
+// with Host, the host sends Host until the joiner answers with JoinAck, at
+// most GRAPHSENDS times GRAPHRESENDMS apart. 0 while the host waits for
+// the first Join.
+int match_sends = 0;
+uint32_t match_sent_us = 0;
+
+// Joiner the host offered its match to and whether the offer came back from
+// the broker. The broker passes lobby messages on in the order they arrive,
+// so an offer of another host that comes back first is the one the joiner takes.
+uint32_t offer_device = 0;
+bool offer_echoed = false;
+
+// Joiners the host may offer a match to, when the offer is due and when
+// they last asked for a match
+struct LobbyJoiner {
+    uint32_t device;
+    uint32_t offer_us;
+    uint32_t seen_us;
+};
+LobbyJoiner lobby_joiners[LOBBYJOINERS];
+int num_of_lobby_joiners = 0;
+
+// Graph sync state: sequence number of the last graph the host sent and
+// whether the joiner confirmed or rejected it, sequence number of the graph
+// the joiner loaded
+uint16_t graph_seq_sent = 0;
+bool graph_acked = false;
+bool graph_rejected = false;
+uint16_t graph_seq_loaded = 0;
+
+// Why the last match ended early, shown under the multiplayer options
+const char *multiplayer_status = NULL;
+
 // Graph related functions
+void AllocateNodes(Graph *g, int num_of_nodes);
+void AllocateEdges(Graph *g, int num_of_edges);
+Point GraphNode(int node);
 void DrawGraph();
-int Orientation(Point p, Point q, Point r);
-bool OnSegment(Point p, Point q, Point r);
+ScreenRect NodeDamage(int node);
+void DrawGraphRegion(ScreenRect rect);
+void DrawEdge(int edge);
+void DrawNode(int16_t x, int16_t y);
+bool ClipLine(float *x1, float *y1, float *x2, float *y2);
+int NodeAt(int16_t x, int16_t y);
+void FlushFramebuffer();
+int MoveNode(int node, int16_t x, int16_t y);
 bool DoIntersect(Point p1, Point q1, Point p2, Point q2);
+void IntersectBatch(int16_t px, int16_t py, int16_t qx, int16_t qy,
+                    const int16_t *x1, const int16_t *y1, const int16_t *x2, const int16_t *y2,
+                    int count, uint8_t *result);
+bool InBatchRange(int16_t x, int16_t y);
+bool EdgesShareNode(int i, int j);
+bool EdgesCross(int i, int j);
 int NumOfIntersections();
-bool CheckConcurrent(int *a, int *b, int *c);
-bool CheckParallel(int *a, int *b);
-Point LineIntersection(int *a, int *b);
+int NumOfIntersectionsBruteForce();
+int NumOfIntersectionsSweep();
+void InitIntersections();
+int UpdateIntersections(int node);
+void UpdateEdgePoints(int edge);
+void SetCrossing(int i, int j);
+GridRange GridRangeOf(int16_t x1, int16_t y1, int16_t x2, int16_t y2);
+void GridSetEdge(int edge, bool present);
+void GridUpdateEdge(int edge);
+void GridEdgesInRect(int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint32_t *result);
+int GridCellOf(int16_t x, int16_t y);
+void GridUpdateNode(int node);
+int LinesNode(int i, int j, int num_of_lines);
+int CompareLinePoints(const void *a, const void *b);
+void LineIntersection(double *a, double *b, double *x, double *y);
+bool PuzzlePlanar();
+bool SolvePuzzle();
+int LayoutEdgeCrossings(const int16_t *x, const int16_t *y);
+int LayoutCrossings(const int16_t *x, const int16_t *y);
+
+// Viewport functions
+ScreenRect PuzzleWorld(int num_of_nodes);
+void ViewReset();
+bool ViewSet(float scale, float world_x, float world_y, float screen_x, float screen_y);
+float ViewClampOrigin(float origin, int16_t world1, int16_t world2, float scale, int pixels);
+float ViewScreenX(float world_x);
+float ViewScreenY(float world_y);
+int32_t ViewRound(float value);
+ScreenRect ViewClamp(float x1, float y1, float x2, float y2);
+bool ViewWorldPoint(int16_t x, int16_t y, int16_t *world_x, int16_t *world_y);
+void ViewGesture(TouchEvent *event);
+void ViewRedraw();
+
+// HUD functions
+void HudInit(const char *time_label);
+void HudSetValue(int field, int value);
+int FormatNumber(int value, char *text, int size);
+void ShowStatus(const char *text, sFONT *font);
+void ClearStatus();
 
-// Ticker functions
+// Drag functions
+bool NextDragSample(TouchEvent *event);
+void FramePresented(uint32_t input_time_us);
+
+// Hint functions
+void HintStart();
+bool HintStep();
+void HintShow();
+void HintDrawMarks();
+void HintClear();
+ScreenRect HintMarkRect(int16_t x, int16_t y);
+int HintScore(int node, int16_t x, int16_t y);
+bool HintPositionFree(int node, int16_t x, int16_t y);
+int NodeCrossings(int node);
+int CompareNodeCrossings(const void *a, const void *b);
+
+// Ticker functions, they only post events for HandleTimerEvents()
 void ClassicTimer();
 void RaceAgainstTimeTimer();
 void RandomNodeChange();
 
+// Timer event functions, run on the main thread
+void PostTimerEvent(int event);
+void DropTimerEvents();
+void HandleTimerEvents();
+void StopTimers();
+void ClassicTick();
+void RaceAgainstTimeTick();
+void MoveRandomNode();
+
 // Main functionality functions
 int MainScreen();
 int Singleplayer(int gamemode);
@@ -71,72 +365,124 @@ int Gamemodes();
 int ThemeSelection();
 int Multiplayer();
 int LevelSelection();
-void GenerateGraph();
+void GenerateGraph(Random *random, int num_of_lines);
+void NewPuzzle(uint32_t seed, int num_of_lines);
+void MakePuzzle(uint32_t seed, int num_of_lines);
+void StartPuzzle();
+uint32_t NewPuzzleSeed();
+bool PoolRefill();
+void PoolTake(int level);
+bool MenuTouchWait(TouchEvent *event);
 int PlayerSelection();
 int Leaderboard();
 
 
 // MQTT related functions
-void MessageArrivedConnecting(MQTT::MessageData& md);
-void MessageArrivedStart(MQTT::MessageData& md);
-void MessageArrivedOpponent(MQTT::MessageData& md);
-void MessageArrivedReceiveNodes(MQTT::MessageData& md);
-void MessageArrivedReceiveConfirmation(MQTT::MessageData& md);
+void HandleNetworkEvents();
+void LobbyTick();
+void LobbyLeaveMatch();
+int LobbyWaitMs();
+void ReceiveGraph(const NetEvent &event);
+bool SyncGraph();
+uint32_t OfferDelayUs(uint32_t device);
+void LobbyJoinerSeen(uint32_t device);
+void LobbyJoinerTaken(uint32_t device);
+int LobbyNextOffer();
+bool BackButtonWait(int timeout_ms);
 
-// Arrays that keeps the nodes and edges of currently generated graph
-Point nodes[NUMOFNODES];
-Edge edges[MAXNUMOFEDGES];
+// Currently generated graph
+Graph graph = {0, 0, NULL, NULL, NULL, NULL};
 
-// Class taken from: https://stackoverflow.com/questions/5076695/how-can-i-iterate-through-every-possible-combination-of-n-playing-cards
-class CombinationsIndexArray { 
-    int index_array[3];         
-    int size_of_index_array;
-    int last_index;
-    public:
-    CombinationsIndexArray(int number_of_things_to_choose_from, int number_of_things_to_choose_in_one_combination) : size_of_index_array(number_of_things_to_choose_in_one_combination) {
-        last_index = number_of_things_to_choose_from - 1;
-        for (int i = 0; i < number_of_things_to_choose_in_one_combination; i++) {
-            index_array[i];
-        }
-    }
-    
-    int operator[](int i) {
-        return index_array[i];
-    }
-    
-    int size() {
-        return size_of_index_array;
-    }
-    
-    bool advance() {
-        int i = size_of_index_array - 1;
-        if (index_array[i] < last_index) {
-            index_array[i]++;
-            return true;
-        } else {
-            while (i > 0 && index_array[i-1] == index_array[i]-1) {
-                i--;
-            }
-            if (i == 0) {
-                return false;
-            } else {
-                index_array[i-1]++;
-                while (i < size_of_index_array) {
-                    index_array[i] = index_array[i-1]+1;
-                    i++;
-                }
-                return true;
-            }
-        }
-    }
-};
+// Seed and number of lines the current graph was made from, they identify
+// the puzzle, and the generator of the Crazy mode moves in it
+uint32_t puzzle_seed = 0;
+int puzzle_lines = 0;
+Random crazy_random;
+
+// Crossing-free layout of the current graph inside the play area found by
+// SolvePuzzle(), it proves the puzzle can be solved
+int16_t *solution_x = NULL;
+int16_t *solution_y = NULL;
+bool solution_found = false;
+
+// Puzzles made in the menus for every level (level - 1), the first
+// pool_count[level - 1] of them are ready
+Puzzle puzzle_pool[NUMOFLEVELS][POOLSIZE];
+int pool_count[NUMOFLEVELS] = {0};
+
+// Crossing state of every pair of edges (one bit per pair, edge_words words
+// per edge) and edges incident to every node (incident_edges[incident_offsets[i]]
+// up to incident_edges[incident_offsets[i + 1]]), used to update the number of
+// crossings when only one node is moved
+int edge_words = 0;
+uint32_t *edge_crossings = NULL;
+int num_of_crossings = 0;
+int *incident_offsets = NULL;
+uint16_t *incident_edges = NULL;
+
+// Edges sorted by their leftmost point, used by the sweep line
+int *sweep_order = NULL;
+
+// Uniform grid over the world, every cell keeps one bit for each edge
+// whose bounding box covers the cell
+int grid_cell_size = GRIDCELLSIZE;
+uint32_t *grid_edges = NULL;
+GridRange *edge_cells = NULL;
+uint32_t *edge_candidates = NULL;
+
+// The same grid for nodes, one bit for each node in the cell (node_words
+// words per cell), and the cell of every node
+int node_words = 0;
+uint32_t *grid_nodes = NULL;
+uint8_t *node_cells = NULL;
+
+// End points of every edge, so that one edge can be tested against many
+// edges with IntersectBatch()
+int16_t *edge_x1 = NULL;
+int16_t *edge_y1 = NULL;
+int16_t *edge_x2 = NULL;
+int16_t *edge_y2 = NULL;
+uint8_t *batch_results = NULL;
+
+// Game screens are drawn here first and then sent to the LCD with FlushFramebuffer()
+uint16_t frame_pixels[SCREENSIZE * SCREENSIZE];
+
+// Part of the world shown in the play area, reset for every puzzle
+Viewport view;
+
+// Message on the status line of the game screen, drawn again over a redrawn view
+const char *status_text = NULL;
+sFONT *status_font = NULL;
+
+// Numbers at the top of the game screens and Font12 glyphs of HUDGLYPHS
+// in the theme colors, copied into the frame instead of drawing the text
+HudField hud_fields[NUMOFHUDFIELDS];
+uint16_t hud_glyphs[HUDGLYPHCOUNT][HUDGLYPHWIDTH * HUDGLYPHHEIGHT];
+
+// Time the last drag frame was sent and whether the finger was lifted while
+// a merged sample was still waiting to be drawn
+uint32_t last_present_us = 0;
+bool drag_released = false;
+
+// Touch to LCD time of the frames drawn during the current drag
+int drag_frames = 0;
+uint32_t drag_latency_sum_us = 0;
+uint32_t drag_latency_max_us = 0;
+
+// Hint search of the Singleplayer screen and the nodes it goes through,
+// the ones with the most crossings first
+HintSearch hint = {false, false, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+int *hint_order = NULL;
+char hint_status[HINTSTATUSLENGTH];
 
 int main() {
     BSP_LCD_Init();
+    FB_Init(frame_pixels, SCREENSIZE, SCREENSIZE);
 
     if (BSP_TS_Init(BSP_LCD_GetXSize(), BSP_LCD_GetYSize()) == TS_ERROR) {
         printf("BSP_TS_Init error\n");
     }
+    TouchInit();
 
     int choice = 1, temp = 0;
     while (true) {
@@ -168,118 +514,1227 @@ int main() {
                 return -1;
         }
     }
-    
-    return 0;
+    
+    return 0;
+}
+
+void DrawGraph() {
+    FB_Clear((themes + theme_selected)->color1);
+    
+    // Only the part of the world in the view is drawn
+    ScreenRect rect = {VIEWX1, VIEWY1, VIEWX2, VIEWY2};
+    DrawGraphRegion(rect);
+}
+
+ScreenRect NodeDamage(int node) {
+    // Part of the view covered by the node and the edges incident to it
+    float x1 = ViewScreenX(graph.x[node]), y1 = ViewScreenY(graph.y[node]);
+    float x2 = x1, y2 = y1;
+    for (int i = incident_offsets[node]; i < incident_offsets[node + 1]; i++) {
+        int edge = incident_edges[i];
+        uint16_t other = (graph.node1[edge] == node) ? (graph.node2[edge]) : (graph.node1[edge]);
+        float x = ViewScreenX(graph.x[other]), y = ViewScreenY(graph.y[other]);
+        x1 = (x < x1) ? (x) : (x1);
+        y1 = (y < y1) ? (y) : (y1);
+        x2 = (x > x2) ? (x) : (x2);
+        y2 = (y > y2) ? (y) : (y2);
+    }
+    return ViewClamp(x1 - NODERADIUS, y1 - NODERADIUS, x2 + NODERADIUS, y2 + NODERADIUS);
+}
+
+void DrawGraphRegion(ScreenRect rect) {
+    // Everything drawn is clipped to the region
+    FB_SetClip(rect.x1, rect.y1, rect.x2, rect.y2);
+    FB_Clear((themes + theme_selected)->color1);
+    FB_SetTextColor((themes + theme_selected)->color2);
+    
+    // Draw edges going through the part of the world under the region
+    int16_t x1 = (int16_t)floorf(view.x + (rect.x1 - VIEWX1 - 0.5f) / view.scale);
+    int16_t y1 = (int16_t)floorf(view.y + (rect.y1 - VIEWY1 - 0.5f) / view.scale);
+    int16_t x2 = (int16_t)ceilf(view.x + (rect.x2 - VIEWX1 + 0.5f) / view.scale);
+    int16_t y2 = (int16_t)ceilf(view.y + (rect.y2 - VIEWY1 + 0.5f) / view.scale);
+    GridEdgesInRect(x1, y1, x2, y2, edge_candidates);
+    for (int w = 0; w < edge_words; w++) {
+        for (uint32_t bits = edge_candidates[w]; bits != 0; bits &= bits - 1) {
+            int edge = 32 * w + __builtin_ctz(bits);
+            if (max(edge_x1[edge], edge_x2[edge]) < x1 || min(edge_x1[edge], edge_x2[edge]) > x2 ||
+                max(edge_y1[edge], edge_y2[edge]) < y1 || min(edge_y1[edge], edge_y2[edge]) > y2) {
+                continue;
+            }
+            DrawEdge(edge);
+        }
+    }
+    
+    // Draw nodes touching the region
+    int radius = (view.scale < LODSCALE) ? (LODRADIUS) : (NODERADIUS);
+    for (int i = 0; i < graph.num_of_nodes; i++) {
+        int32_t x = ViewRound(ViewScreenX(graph.x[i])), y = ViewRound(ViewScreenY(graph.y[i]));
+        if (x + radius < rect.x1 || x - radius > rect.x2 || y + radius < rect.y1 || y - radius > rect.y2) {
+            continue;
+        }
+        DrawNode(x, y);
+    }
+    
+    FB_ResetClip();
+}
+
+void DrawEdge(int edge) {
+    // The line is cut to the view first, so a line reaching far out of it is
+    // not walked pixel by pixel and its ends always fit in int16_t
+    float x1 = ViewScreenX(edge_x1[edge]), y1 = ViewScreenY(edge_y1[edge]);
+    float x2 = ViewScreenX(edge_x2[edge]), y2 = ViewScreenY(edge_y2[edge]);
+    if (ClipLine(&x1, &y1, &x2, &y2)) {
+        FB_DrawLine(ViewRound(x1), ViewRound(y1), ViewRound(x2), ViewRound(y2));
+    }
+}
+
+void DrawNode(int16_t x, int16_t y) {
+    // Zoomed far out a node is only a small square, a circle costs more than it shows
+    FB_SetTextColor((themes + theme_selected)->color3);
+    if (view.scale < LODSCALE) {
+        FB_FillRect(x - LODRADIUS, y - LODRADIUS, 2 * LODRADIUS + 1, 2 * LODRADIUS + 1);
+        return;
+    }
+    FB_FillCircle(x, y, NODERADIUS);
+    FB_SetTextColor((themes + theme_selected)->color2);
+    FB_DrawCircle(x, y, NODERADIUS);
+}
+
+bool ClipLine(float *x1, float *y1, float *x2, float *y2) {
+    // Liang-Barsky, the part of the line inside the view goes from t0 to t1,
+    // false when nothing is inside. Ends inside the view are not changed.
+    float dx = *x2 - *x1, dy = *y2 - *y1;
+    float p[4] = {-dx, dx, -dy, dy};
+    float q[4] = {*x1 - VIEWX1, VIEWX2 - *x1, *y1 - VIEWY1, VIEWY2 - *y1};
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0f) {
+            // Parallel to this border
+            if (q[i] < 0.0f) {
+                return false;
+            }
+            continue;
+        }
+        float t = q[i] / p[i];
+        if (p[i] < 0.0f) {
+            t0 = (t > t0) ? (t) : (t0);
+        } else {
+            t1 = (t < t1) ? (t) : (t1);
+        }
+    }
+    if (t0 > t1) {
+        return false;
+    }
+    
+    // The far end first, it is measured from the old near end
+    if (t1 < 1.0f) {
+        *x2 = *x1 + t1 * dx;
+        *y2 = *y1 + t1 * dy;
+    }
+    if (t0 > 0.0f) {
+        *x1 += t0 * dx;
+        *y1 += t0 * dy;
+    }
+    return true;
+}
+
+int NodeAt(int16_t x, int16_t y) {
+    // Nearest node drawn within TOUCHRADIUS of the screen point, -1 when there
+    // is none. Only grid cells that close to the point are searched.
+    if (y < VIEWY1) {
+        return -1;
+    }
+    float radius = TOUCHRADIUS / view.scale;
+    float world_x = view.x + (x - VIEWX1) / view.scale, world_y = view.y + (y - VIEWY1) / view.scale;
+    GridRange range = GridRangeOf((int16_t)floorf(world_x - radius), (int16_t)floorf(world_y - radius),
+                                  (int16_t)ceilf(world_x + radius), (int16_t)ceilf(world_y + radius));
+    
+    int nearest = -1;
+    int32_t nearest_distance = TOUCHRADIUS * TOUCHRADIUS + 1;
+    for (int i = range.y1; i <= range.y2; i++) {
+        for (int j = range.x1; j <= range.x2; j++) {
+            uint32_t *cell = grid_nodes + (i * GRIDSIZE + j) * node_words;
+            for (int w = 0; w < node_words; w++) {
+                for (uint32_t bits = cell[w]; bits != 0; bits &= bits - 1) {
+                    int node = 32 * w + __builtin_ctz(bits);
+                    int32_t dx = x - ViewRound(ViewScreenX(graph.x[node])), dy = y - ViewRound(ViewScreenY(graph.y[node]));
+                    if (dx < -TOUCHRADIUS || dx > TOUCHRADIUS || dy < -TOUCHRADIUS || dy > TOUCHRADIUS) {
+                        continue;
+                    }
+                    
+                    // Of nodes equally far the first one, as cells come in any order
+                    int32_t distance = dx * dx + dy * dy;
+                    if (distance < nearest_distance || (distance == nearest_distance && node < nearest)) {
+                        nearest = node;
+                        nearest_distance = distance;
+                    }
+                }
+            }
+        }
+    }
+    return nearest;
+}
+
+void FlushFramebuffer() {
+    // Lines changed since the last flush are sent to the LCD in one transfer
+    int16_t y1, y2;
+    if (FB_GetDirtyLines(&y1, &y2)) {
+        BSP_LCD_DrawRGBImage(0, y1, FB_GetXSize(), y2 - y1 + 1, (uint8_t *)FB_GetLine(y1));
+        FB_ClearDirty();
+    }
+}
+
+int MoveNode(int node, int16_t x, int16_t y) {
+    // A hint is only good for the layout it was found in
+    if (hint.active || hint.shown) {
+        HintClear();
+    }
+    
+    // Only the old and the new position of the node and its edges need to be drawn again
+    ScreenRect rect = NodeDamage(node);
+    graph.x[node] = x;
+    graph.y[node] = y;
+    int num_of_intersections = UpdateIntersections(node);
+    
+    ScreenRect moved = NodeDamage(node);
+    rect.x1 = min(rect.x1, moved.x1);
+    rect.y1 = min(rect.y1, moved.y1);
+    rect.x2 = max(rect.x2, moved.x2);
+    rect.y2 = max(rect.y2, moved.y2);
+    DrawGraphRegion(rect);
+    
+    return num_of_intersections;
+}
+
+ScreenRect PuzzleWorld(int num_of_nodes) {
+    // The play area, grown for puzzles larger than the hardest level. It only
+    // depends on the graph, so both players of a match get the same world.
+    ScreenRect world = {5, 41, 234, 234};
+    if (num_of_nodes > WORLDNODES) {
+        float grow = sqrtf((float)num_of_nodes / WORLDNODES);
+        world.x2 = world.x1 + (int16_t)((world.x2 - world.x1) * grow);
+        world.y2 = world.y1 + (int16_t)((world.y2 - world.y1) * grow);
+    }
+    return world;
+}
+
+void ViewReset() {
+    // The whole world as large as it fits, never more than one pixel per unit
+    view.world = PuzzleWorld(graph.num_of_nodes);
+    float scale_x = (float)(VIEWX2 - VIEWX1 - 2 * NODERADIUS) / (view.world.x2 - view.world.x1);
+    float scale_y = (float)(VIEWY2 - VIEWY1 - 2 * NODERADIUS) / (view.world.y2 - view.world.y1);
+    view.min_scale = (scale_x < scale_y) ? (scale_x) : (scale_y);
+    view.min_scale = (view.min_scale < 1.0f) ? (view.min_scale) : (1.0f);
+    view.scale = 0.0f;
+    ViewSet(view.min_scale, (view.world.x1 + view.world.x2) / 2.0f, (view.world.y1 + view.world.y2) / 2.0f,
+            (VIEWX1 + VIEWX2) / 2.0f, (VIEWY1 + VIEWY2) / 2.0f);
+}
+
+bool ViewSet(float scale, float world_x, float world_y, float screen_x, float screen_y) {
+    // The world point is put at the screen point as far as the borders of the
+    // world allow, true when the view changed
+    scale = (scale < view.min_scale) ? (view.min_scale) : ((scale > VIEWMAXSCALE) ? (VIEWMAXSCALE) : (scale));
+    float x = ViewClampOrigin(world_x - (screen_x - VIEWX1) / scale, view.world.x1, view.world.x2, scale, VIEWX2 - VIEWX1);
+    float y = ViewClampOrigin(world_y - (screen_y - VIEWY1) / scale, view.world.y1, view.world.y2, scale, VIEWY2 - VIEWY1);
+    if (scale == view.scale && x == view.x && y == view.y) {
+        return false;
+    }
+    view.scale = scale;
+    view.x = x;
+    view.y = y;
+    return true;
+}
+
+float ViewClampOrigin(float origin, int16_t world1, int16_t world2, float scale, int pixels) {
+    // Along one axis a world that fits is centered, otherwise the view stays
+    // within it. Nodes on the border of the world are drawn whole.
+    float low = world1 - NODERADIUS / scale, high = world2 + NODERADIUS / scale, span = pixels / scale;
+    if (high - low <= span) {
+        return (low + high - span) / 2.0f;
+    }
+    return (origin < low) ? (low) : ((origin > high - span) ? (high - span) : (origin));
+}
+
+float ViewScreenX(float world_x) {
+    return VIEWX1 + (world_x - view.x) * view.scale;
+}
+
+float ViewScreenY(float world_y) {
+    return VIEWY1 + (world_y - view.y) * view.scale;
+}
+
+int32_t ViewRound(float value) {
+    return (int32_t)floorf(value + 0.5f);
+}
+
+ScreenRect ViewClamp(float x1, float y1, float x2, float y2) {
+    // Pixels covering the rectangle, limited to the view
+    x1 = floorf(x1);
+    y1 = floorf(y1);
+    x2 = ceilf(x2);
+    y2 = ceilf(y2);
+    ScreenRect rect = {(int16_t)((x1 < VIEWX1) ? (VIEWX1) : ((x1 > VIEWX2) ? (VIEWX2) : (x1))),
+                       (int16_t)((y1 < VIEWY1) ? (VIEWY1) : ((y1 > VIEWY2) ? (VIEWY2) : (y1))),
+                       (int16_t)((x2 < VIEWX1) ? (VIEWX1) : ((x2 > VIEWX2) ? (VIEWX2) : (x2))),
+                       (int16_t)((y2 < VIEWY1) ? (VIEWY1) : ((y2 > VIEWY2) ? (VIEWY2) : (y2)))};
+    return rect;
+}
+
+bool ViewWorldPoint(int16_t x, int16_t y, int16_t *world_x, int16_t *world_y) {
+    // World point under the screen point, false when it is outside the world
+    int32_t point_x = ViewRound(view.x + (x - VIEWX1) / view.scale);
+    int32_t point_y = ViewRound(view.y + (y - VIEWY1) / view.scale);
+    if (point_x < view.world.x1 || point_x > view.world.x2 || point_y < view.world.y1 || point_y > view.world.y2) {
+        return false;
+    }
+    *world_x = point_x;
+    *world_y = point_y;
+    return true;
+}
+
+void ViewGesture(TouchEvent *event) {
+    // One finger drags the world, two fingers zoom it as well. The world point
+    // under the finger (between two fingers) stays under it, it is taken again
+    // whenever the number of fingers changes.
+    uint8_t count = 0;
+    float anchor_x = 0.0f, anchor_y = 0.0f, anchor_distance = 0.0f, anchor_scale = view.scale;
+    do {
+        float x = event->x, y = event->y, distance = 0.0f;
+        if (event->count == 2) {
+            float dx = (float)event->x2 - event->x, dy = (float)event->y2 - event->y;
+            x += dx / 2.0f;
+            y += dy / 2.0f;
+            distance = sqrtf(dx * dx + dy * dy);
+        }
+        if (event->count != count) {
+            count = event->count;
+            anchor_x = view.x + (x - VIEWX1) / view.scale;
+            anchor_y = view.y + (y - VIEWY1) / view.scale;
+            anchor_distance = distance;
+            anchor_scale = view.scale;
+        }
+        
+        float scale = view.scale;
+        if (count == 2 && anchor_distance >= PINCHMINDISTANCE) {
+            scale = anchor_scale * distance / anchor_distance;
+        }
+        if (ViewSet(scale, anchor_x, anchor_y, x, y)) {
+            ViewRedraw();
+            FlushFramebuffer();
+            FramePresented(event->time_us);
+        }
+    } while (NextDragSample(event));
+}
+
+void ViewRedraw() {
+    // The HUD and the buttons are above the view and stay as they are
+    ScreenRect rect = {VIEWX1, VIEWY1, VIEWX2, VIEWY2};
+    DrawGraphRegion(rect);
+    if (hint.shown) {
+        HintDrawMarks();
+    }
+    if (status_text != NULL) {
+        ShowStatus(status_text, status_font);
+    }
+}
+
+void HudInit(const char *time_label) {
+    const char *labels[NUMOFHUDFIELDS] = {"Number of line crossings: ", "Moves taken: ", time_label};
+    FB_SetFont(&Font12);
+    FB_SetBackColor((themes + theme_selected)->color1);
+    FB_SetTextColor((themes + theme_selected)->color2);
+    
+    // Labels are drawn once, text never starts before column 1
+    for (int i = 0; i < NUMOFHUDFIELDS; i++) {
+        FB_DisplayStringAt(0, 12 * i, (uint8_t *)labels[i], FB_LEFT_MODE);
+        (hud_fields + i)->x = 1 + strlen(labels[i]) * HUDGLYPHWIDTH;
+        (hud_fields + i)->y = 12 * i;
+        (hud_fields + i)->suffix = (i == HUD_TIME) ? ('s') : ('\0');
+        memset((hud_fields + i)->shown, 0, HUDFIELDLENGTH);
+    }
+    
+    for (int i = 0; i < HUDGLYPHCOUNT; i++) {
+        FB_RenderChar(HUDGLYPHS[i], hud_glyphs[i]);
+    }
+}
+
+void HudSetValue(int field, int value) {
+    HudField *hud = hud_fields + field;
+    char text[HUDFIELDLENGTH];
+    int length = FormatNumber(value, text, HUDFIELDLENGTH);
+    if (hud->suffix != '\0' && length < HUDFIELDLENGTH) {
+        text[length++] = hud->suffix;
+    }
+    while (length < HUDFIELDLENGTH) {
+        text[length++] = ' ';
+    }
+    
+    // Only characters that differ from the ones on the screen are copied
+    for (int i = 0; i < HUDFIELDLENGTH; i++) {
+        if (text[i] != hud->shown[i]) {
+            int glyph = strchr(HUDGLYPHS, text[i]) - HUDGLYPHS;
+            FB_DrawImage(hud->x + i * HUDGLYPHWIDTH, hud->y, HUDGLYPHWIDTH, HUDGLYPHHEIGHT, hud_glyphs[glyph]);
+            hud->shown[i] = text[i];
+        }
+    }
+}
+
+int FormatNumber(int value, char *text, int size) {
+    // Digits come out from the last one, at most size characters are written
+    char digits[10];
+    int count = 0;
+    unsigned int magnitude = (value < 0) ? (0u - (unsigned int)value) : ((unsigned int)value);
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+    
+    int length = 0;
+    if (value < 0 && length < size) {
+        text[length++] = '-';
+    }
+    while (count > 0 && length < size) {
+        text[length++] = digits[--count];
+    }
+    return length;
+}
+
+void ShowStatus(const char *text, sFONT *font) {
+    status_text = text;
+    status_font = font;
+    FB_SetTextColor((themes + theme_selected)->color3);
+    FB_SetBackColor((themes + theme_selected)->color1);
+    FB_SetFont(font);
+    FB_DisplayStringAt(0, STATUSY, (uint8_t *)text, FB_CENTER_MODE);
+}
+
+void ClearStatus() {
+    status_text = NULL;
+    ScreenRect message = {0, STATUSY, (int16_t)(FB_GetXSize() - 1), STATUSY + 11};
+    DrawGraphRegion(message);
+}
+
+bool NextDragSample(TouchEvent *event) {
+    if (drag_released) {
+        drag_released = false;
+#if PROFILE
+        if (drag_frames != 0) {
+            printf("Drag: %d frames, touch to LCD mean %lu us, max %lu us\n", drag_frames,
+                   (unsigned long)(drag_latency_sum_us / drag_frames), (unsigned long)drag_latency_max_us);
+        }
+#endif
+        drag_frames = 0;
+        drag_latency_sum_us = 0;
+        drag_latency_max_us = 0;
+        return false;
+    }
+
+    // Moves that arrive before the next frame is due only replace the position
+    bool moved = false;
+    while (true) {
+        int timeout_ms = TOUCHFOREVER;
+        if (moved) {
+            int32_t left_us = FRAMEPERIODUS - (int32_t)(us_ticker_read() - last_present_us);
+            if (left_us <= 0) {
+                return true;
+            }
+            timeout_ms = (left_us + 999) / 1000;
+        }
+
+        // Woken up by a ticker or the next frame is due
+        TouchEvent next;
+        if (!TouchWait(&next, timeout_ms)) {
+            HandleTimerEvents();
+            continue;
+        }
+        if (next.type == TOUCH_RELEASE) {
+            // The last position is still drawn before the drag ends
+            drag_released = true;
+            return (moved) ? (true) : (NextDragSample(event));
+        }
+        *event = next;
+        moved = true;
+    }
+}
+
+void FramePresented(uint32_t input_time_us) {
+    last_present_us = us_ticker_read();
+    uint32_t latency_us = last_present_us - input_time_us;
+    drag_frames++;
+    drag_latency_sum_us += latency_us;
+    drag_latency_max_us = max(drag_latency_max_us, latency_us);
+}
+
+void HintStart() {
+    // Only moving a node with crossings can remove crossings
+    delete[] hint_order;
+    hint_order = new int[graph.num_of_nodes];
+    hint.num_of_nodes = 0;
+    for (int i = 0; i < graph.num_of_nodes; i++) {
+        if (NodeCrossings(i) != 0) {
+            hint_order[hint.num_of_nodes++] = i;
+        }
+    }
+    qsort(hint_order, hint.num_of_nodes, sizeof(int), CompareNodeCrossings);
+    
+    hint.active = true;
+    hint.start_us = us_ticker_read();
+    hint.order_index = 0;
+    hint.candidate = 0;
+    hint.scored = 0;
+    hint.slices = 0;
+    hint.best_gain = 0;
+}
+
+bool HintStep() {
+    // Score candidate positions until the slice is used up, true when the
+    // search is over
+    uint32_t slice_start_us = us_ticker_read();
+    hint.slices++;
+    while (hint.order_index < hint.num_of_nodes) {
+        int node = hint_order[hint.order_index];
+        int candidate = hint.candidate++;
+        if (hint.candidate > HINTCOLUMNS * HINTROWS) {
+            hint.order_index++;
+            hint.candidate = 0;
+        }
+        
+        // The place of the node in the solution is tried first
+        int16_t x, y;
+        if (candidate == 0) {
+            if (!solution_found) {
+                continue;
+            }
+            x = solution_x[node];
+            y = solution_y[node];
+        } else {
+            int step_x = (view.world.x2 - view.world.x1 + 1) / HINTCOLUMNS;
+            int step_y = (view.world.y2 - view.world.y1 + 1) / HINTROWS;
+            x = view.world.x1 + step_x / 2 + step_x * ((candidate - 1) % HINTCOLUMNS);
+            y = view.world.y1 + step_y / 2 + step_y * ((candidate - 1) / HINTCOLUMNS);
+        }
+        
+        if (HintPositionFree(node, x, y)) {
+            int gain = NodeCrossings(node) - HintScore(node, x, y);
+            hint.scored++;
+            if (gain > hint.best_gain) {
+                hint.best_gain = gain;
+                hint.best_node = node;
+                hint.best_x = x;
+                hint.best_y = y;
+            }
+        }
+        
+        if (us_ticker_read() - slice_start_us >= HINTSLICEUS) {
+            break;
+        }
+    }
+    
+    if (hint.order_index < hint.num_of_nodes && us_ticker_read() - hint.start_us < HINTBUDGETUS) {
+        return false;
+    }
+    hint.active = false;
+#if PROFILE
+    printf("Hint: %d positions in %d slices, %lu us\n", hint.scored, hint.slices,
+           (unsigned long)(us_ticker_read() - hint.start_us));
+#endif
+    return true;
+}
+
+void HintShow() {
+    // The outcome stays on the status line until the hint is cleared
+    if (hint.best_gain <= 0) {
+        strcpy(hint_status, "No move removes a crossing");
+        ShowStatus(hint_status, &Font12);
+        return;
+    }
+    snprintf(hint_status, HINTSTATUSLENGTH, "Marked move removes %d crossing%s", hint.best_gain,
+             (hint.best_gain == 1) ? ("") : ("s"));
+    ShowStatus(hint_status, &Font12);
+    HintDrawMarks();
+    hint.shown = true;
+}
+
+void HintDrawMarks() {
+    // Ring around the node and around the place it should go to, a mark
+    // outside the view is left out
+    int16_t world_x[2] = {graph.x[hint.best_node], hint.best_x};
+    int16_t world_y[2] = {graph.y[hint.best_node], hint.best_y};
+    FB_SetClip(VIEWX1, VIEWY1, VIEWX2, VIEWY2);
+    FB_SetTextColor((themes + theme_selected)->color3);
+    for (int i = 0; i < 2; i++) {
+        int32_t x = ViewRound(ViewScreenX(world_x[i])), y = ViewRound(ViewScreenY(world_y[i]));
+        if (x < VIEWX1 - NODERADIUS - 3 || x > VIEWX2 + NODERADIUS + 3 || y < VIEWY1 - NODERADIUS - 3 || y > VIEWY2 + NODERADIUS + 3) {
+            continue;
+        }
+        FB_DrawCircle(x, y, NODERADIUS + 3);
+        if (i == 1) {
+            FB_DrawCircle(x, y, NODERADIUS);
+        }
+    }
+    FB_ResetClip();
+}
+
+void HintClear() {
+    hint.active = false;
+    if (status_text == hint_status) {
+        ClearStatus();
+    }
+    if (hint.shown) {
+        hint.shown = false;
+        DrawGraphRegion(HintMarkRect(graph.x[hint.best_node], graph.y[hint.best_node]));
+        DrawGraphRegion(HintMarkRect(hint.best_x, hint.best_y));
+    }
+}
+
+ScreenRect HintMarkRect(int16_t x, int16_t y) {
+    float screen_x = ViewScreenX(x), screen_y = ViewScreenY(y);
+    return ViewClamp(screen_x - NODERADIUS - 3, screen_y - NODERADIUS - 3, screen_x + NODERADIUS + 3, screen_y + NODERADIUS + 3);
+}
+
+int HintScore(int node, int16_t x, int16_t y) {
+    // Crossings of the edges of the node if it were at x and y, every edge
+    // is tested against all edges at once
+    int count = 0;
+    for (int i = incident_offsets[node]; i < incident_offsets[node + 1]; i++) {
+        int edge = incident_edges[i];
+        uint16_t other = (graph.node1[edge] == node) ? (graph.node2[edge]) : (graph.node1[edge]);
+        IntersectBatch(x, y, graph.x[other], graph.y[other], edge_x1, edge_y1, edge_x2, edge_y2,
+                       graph.num_of_edges, batch_results);
+        for (int j = 0; j < graph.num_of_edges; j++) {
+            count += batch_results[j];
+        }
+        
+        // Edges with a common node never cross, the edge itself is in both lists
+        for (int j = incident_offsets[node]; j < incident_offsets[node + 1]; j++) {
+            count -= batch_results[incident_edges[j]];
+        }
+        for (int j = incident_offsets[other]; j < incident_offsets[other + 1]; j++) {
+            if (incident_edges[j] != edge) {
+                count -= batch_results[incident_edges[j]];
+            }
+        }
+    }
+    return count;
+}
+
+bool HintPositionFree(int node, int16_t x, int16_t y) {
+    // A node is never sent on top of another one
+    for (int i = 0; i < graph.num_of_nodes; i++) {
+        int dx = x - graph.x[i], dy = y - graph.y[i];
+        if (i != node && dx * dx + dy * dy < 4 * NODERADIUS * NODERADIUS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int NodeCrossings(int node) {
+    // Edges of one node never cross each other, so no pair is counted twice
+    int count = 0;
+    for (int i = incident_offsets[node]; i < incident_offsets[node + 1]; i++) {
+        uint32_t *row = edge_crossings + incident_edges[i] * edge_words;
+        for (int w = 0; w < edge_words; w++) {
+            count += __builtin_popcount(row[w]);
+        }
+    }
+    return count;
+}
+
+int CompareNodeCrossings(const void *a, const void *b) {
+    return NodeCrossings(*(const int *)b) - NodeCrossings(*(const int *)a);
+}
+
+bool DoIntersect(Point p1, Point q1, Point p2, Point q2) {
+    // Exact for any coordinates, see Predicates.h
+    return SegmentsIntersect(p1.X, p1.Y, q1.X, q1.Y, p2.X, p2.Y, q2.X, q2.Y);
+}
+
+void IntersectBatch(int16_t px, int16_t py, int16_t qx, int16_t qy,
+                    const int16_t *x1, const int16_t *y1, const int16_t *x2, const int16_t *y2,
+                    int count, uint8_t *result) {
+    int i = 0;
+    
+#if defined(__AVX2__)
+    // Segment p1q1 is the same in every lane, segments p2q2 are 8 at a time
+    __m256i p1x = _mm256_set1_epi32(px), p1y = _mm256_set1_epi32(py);
+    __m256i q1x = _mm256_set1_epi32(qx), q1y = _mm256_set1_epi32(qy);
+    __m256i min1x = _mm256_min_epi32(p1x, q1x), max1x = _mm256_max_epi32(p1x, q1x);
+    __m256i min1y = _mm256_min_epi32(p1y, q1y), max1y = _mm256_max_epi32(p1y, q1y);
+    __m256i dx1 = _mm256_sub_epi32(q1x, p1x), dy1 = _mm256_sub_epi32(q1y, p1y);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i range = _mm256_set1_epi32(BATCHRANGE), minus_range = _mm256_set1_epi32(-BATCHRANGE);
+    int vector_count = (InBatchRange(px, py) && InBatchRange(qx, qy)) ? (count) : (0);
+    for (; i + 8 <= vector_count; i += 8) {
+        __m256i p2x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(x1 + i)));
+        __m256i p2y = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(y1 + i)));
+        __m256i q2x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(x2 + i)));
+        __m256i q2y = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(y2 + i)));
+        
+        // Quick reject when no bounding boxes overlap
+        __m256i min2x = _mm256_min_epi32(p2x, q2x), max2x = _mm256_max_epi32(p2x, q2x);
+        __m256i min2y = _mm256_min_epi32(p2y, q2y), max2y = _mm256_max_epi32(p2y, q2y);
+        __m256i apart = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(min2x, max1x), _mm256_cmpgt_epi32(min1x, max2x)),
+                                        _mm256_or_si256(_mm256_cmpgt_epi32(min2y, max1y), _mm256_cmpgt_epi32(min1y, max2y)));
+        if (_mm256_movemask_epi8(apart) == -1) {
+            memset(result + i, 0, 8);
+            continue;
+        }
+        __m256i outside = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(max2x, range), _mm256_cmpgt_epi32(minus_range, min2x)),
+                                          _mm256_or_si256(_mm256_cmpgt_epi32(max2y, range), _mm256_cmpgt_epi32(minus_range, min2y)));
+        if (!_mm256_testz_si256(outside, outside)) {
+            for (int k = 0; k < 8; k++) {
+                result[i + k] = SegmentsIntersect(px, py, qx, qy, x1[i + k], y1[i + k], x2[i + k], y2[i + k]);
+            }
+            continue;
+        }
+        
+        // OrientationSign() of all four triples as values, not signs
+        __m256i dx2 = _mm256_sub_epi32(q2x, p2x), dy2 = _mm256_sub_epi32(q2y, p2y);
+        __m256i o1 = _mm256_sub_epi32(_mm256_mullo_epi32(dy1, _mm256_sub_epi32(p2x, q1x)), _mm256_mullo_epi32(dx1, _mm256_sub_epi32(p2y, q1y)));
+        __m256i o2 = _mm256_sub_epi32(_mm256_mullo_epi32(dy1, _mm256_sub_epi32(q2x, q1x)), _mm256_mullo_epi32(dx1, _mm256_sub_epi32(q2y, q1y)));
+        __m256i o3 = _mm256_sub_epi32(_mm256_mullo_epi32(dy2, _mm256_sub_epi32(p1x, q2x)), _mm256_mullo_epi32(dx2, _mm256_sub_epi32(p1y, q2y)));
+        __m256i o4 = _mm256_sub_epi32(_mm256_mullo_epi32(dy2, _mm256_sub_epi32(q1x, q2x)), _mm256_mullo_epi32(dx2, _mm256_sub_epi32(q1y, q2y)));
+        
+        // General case, orientations differ in sign
+        __m256i differ12 = _mm256_or_si256(_mm256_xor_si256(_mm256_cmpgt_epi32(o1, zero), _mm256_cmpgt_epi32(o2, zero)),
+                                           _mm256_xor_si256(_mm256_cmpgt_epi32(zero, o1), _mm256_cmpgt_epi32(zero, o2)));
+        __m256i differ34 = _mm256_or_si256(_mm256_xor_si256(_mm256_cmpgt_epi32(o3, zero), _mm256_cmpgt_epi32(o4, zero)),
+                                           _mm256_xor_si256(_mm256_cmpgt_epi32(zero, o3), _mm256_cmpgt_epi32(zero, o4)));
+        __m256i hit = _mm256_and_si256(differ12, differ34);
+        
+        // Special cases, colinear point lying inside the other bounding box
+        __m256i out_p2 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(p2x, max1x), _mm256_cmpgt_epi32(min1x, p2x)),
+                                         _mm256_or_si256(_mm256_cmpgt_epi32(p2y, max1y), _mm256_cmpgt_epi32(min1y, p2y)));
+        __m256i out_q2 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(q2x, max1x), _mm256_cmpgt_epi32(min1x, q2x)),
+                                         _mm256_or_si256(_mm256_cmpgt_epi32(q2y, max1y), _mm256_cmpgt_epi32(min1y, q2y)));
+        __m256i out_p1 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(p1x, max2x), _mm256_cmpgt_epi32(min2x, p1x)),
+                                         _mm256_or_si256(_mm256_cmpgt_epi32(p1y, max2y), _mm256_cmpgt_epi32(min2y, p1y)));
+        __m256i out_q1 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(q1x, max2x), _mm256_cmpgt_epi32(min2x, q1x)),
+                                         _mm256_or_si256(_mm256_cmpgt_epi32(q1y, max2y), _mm256_cmpgt_epi32(min2y, q1y)));
+        hit = _mm256_or_si256(hit, _mm256_andnot_si256(out_p2, _mm256_cmpeq_epi32(o1, zero)));
+        hit = _mm256_or_si256(hit, _mm256_andnot_si256(out_q2, _mm256_cmpeq_epi32(o2, zero)));
+        hit = _mm256_or_si256(hit, _mm256_andnot_si256(out_p1, _mm256_cmpeq_epi32(o3, zero)));
+        hit = _mm256_or_si256(hit, _mm256_andnot_si256(out_q1, _mm256_cmpeq_epi32(o4, zero)));
+        
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        for (int k = 0; k < 8; k++) {
+            result[i + k] = (mask >> k) & 1;
+        }
+    }
+#elif defined(__SSE4_1__)
+    // Segment p1q1 is the same in every lane, segments p2q2 are 4 at a time
+    __m128i p1x = _mm_set1_epi32(px), p1y = _mm_set1_epi32(py);
+    __m128i q1x = _mm_set1_epi32(qx), q1y = _mm_set1_epi32(qy);
+    __m128i min1x = _mm_min_epi32(p1x, q1x), max1x = _mm_max_epi32(p1x, q1x);
+    __m128i min1y = _mm_min_epi32(p1y, q1y), max1y = _mm_max_epi32(p1y, q1y);
+    __m128i dx1 = _mm_sub_epi32(q1x, p1x), dy1 = _mm_sub_epi32(q1y, p1y);
+    __m128i zero = _mm_setzero_si128();
+    __m128i range = _mm_set1_epi32(BATCHRANGE), minus_range = _mm_set1_epi32(-BATCHRANGE);
+    int vector_count = (InBatchRange(px, py) && InBatchRange(qx, qy)) ? (count) : (0);
+    for (; i + 4 <= vector_count; i += 4) {
+        __m128i p2x = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(x1 + i)));
+        __m128i p2y = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(y1 + i)));
+        __m128i q2x = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(x2 + i)));
+        __m128i q2y = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(y2 + i)));
+        
+        // Quick reject when no bounding boxes overlap
+        __m128i min2x = _mm_min_epi32(p2x, q2x), max2x = _mm_max_epi32(p2x, q2x);
+        __m128i min2y = _mm_min_epi32(p2y, q2y), max2y = _mm_max_epi32(p2y, q2y);
+        __m128i apart = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(min2x, max1x), _mm_cmpgt_epi32(min1x, max2x)),
+                                     _mm_or_si128(_mm_cmpgt_epi32(min2y, max1y), _mm_cmpgt_epi32(min1y, max2y)));
+        if (_mm_movemask_epi8(apart) == 0xFFFF) {
+            memset(result + i, 0, 4);
+            continue;
+        }
+        __m128i outside = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(max2x, range), _mm_cmplt_epi32(min2x, minus_range)),
+                                       _mm_or_si128(_mm_cmpgt_epi32(max2y, range), _mm_cmplt_epi32(min2y, minus_range)));
+        if (!_mm_testz_si128(outside, outside)) {
+            for (int k = 0; k < 4; k++) {
+                result[i + k] = SegmentsIntersect(px, py, qx, qy, x1[i + k], y1[i + k], x2[i + k], y2[i + k]);
+            }
+            continue;
+        }
+        
+        // OrientationSign() of all four triples as values, not signs
+        __m128i dx2 = _mm_sub_epi32(q2x, p2x), dy2 = _mm_sub_epi32(q2y, p2y);
+        __m128i o1 = _mm_sub_epi32(_mm_mullo_epi32(dy1, _mm_sub_epi32(p2x, q1x)), _mm_mullo_epi32(dx1, _mm_sub_epi32(p2y, q1y)));
+        __m128i o2 = _mm_sub_epi32(_mm_mullo_epi32(dy1, _mm_sub_epi32(q2x, q1x)), _mm_mullo_epi32(dx1, _mm_sub_epi32(q2y, q1y)));
+        __m128i o3 = _mm_sub_epi32(_mm_mullo_epi32(dy2, _mm_sub_epi32(p1x, q2x)), _mm_mullo_epi32(dx2, _mm_sub_epi32(p1y, q2y)));
+        __m128i o4 = _mm_sub_epi32(_mm_mullo_epi32(dy2, _mm_sub_epi32(q1x, q2x)), _mm_mullo_epi32(dx2, _mm_sub_epi32(q1y, q2y)));
+        
+        // General case, orientations differ in sign
+        __m128i differ12 = _mm_or_si128(_mm_xor_si128(_mm_cmpgt_epi32(o1, zero), _mm_cmpgt_epi32(o2, zero)),
+                                        _mm_xor_si128(_mm_cmplt_epi32(o1, zero), _mm_cmplt_epi32(o2, zero)));
+        __m128i differ34 = _mm_or_si128(_mm_xor_si128(_mm_cmpgt_epi32(o3, zero), _mm_cmpgt_epi32(o4, zero)),
+                                        _mm_xor_si128(_mm_cmplt_epi32(o3, zero), _mm_cmplt_epi32(o4, zero)));
+        __m128i hit = _mm_and_si128(differ12, differ34);
+        
+        // Special cases, colinear point lying inside the other bounding box
+        __m128i out_p2 = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(p2x, max1x), _mm_cmplt_epi32(p2x, min1x)),
+                                      _mm_or_si128(_mm_cmpgt_epi32(p2y, max1y), _mm_cmplt_epi32(p2y, min1y)));
+        __m128i out_q2 = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(q2x, max1x), _mm_cmplt_epi32(q2x, min1x)),
+                                      _mm_or_si128(_mm_cmpgt_epi32(q2y, max1y), _mm_cmplt_epi32(q2y, min1y)));
+        __m128i out_p1 = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(p1x, max2x), _mm_cmplt_epi32(p1x, min2x)),
+                                      _mm_or_si128(_mm_cmpgt_epi32(p1y, max2y), _mm_cmplt_epi32(p1y, min2y)));
+        __m128i out_q1 = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(q1x, max2x), _mm_cmplt_epi32(q1x, min2x)),
+                                      _mm_or_si128(_mm_cmpgt_epi32(q1y, max2y), _mm_cmplt_epi32(q1y, min2y)));
+        hit = _mm_or_si128(hit, _mm_andnot_si128(out_p2, _mm_cmpeq_epi32(o1, zero)));
+        hit = _mm_or_si128(hit, _mm_andnot_si128(out_q2, _mm_cmpeq_epi32(o2, zero)));
+        hit = _mm_or_si128(hit, _mm_andnot_si128(out_p1, _mm_cmpeq_epi32(o3, zero)));
+        hit = _mm_or_si128(hit, _mm_andnot_si128(out_q1, _mm_cmpeq_epi32(o4, zero)));
+        
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(hit));
+        for (int k = 0; k < 4; k++) {
+            result[i + k] = (mask >> k) & 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    // Segment p1q1 is the same in every lane, segments p2q2 are 4 at a time
+    int32x4_t p1x = vdupq_n_s32(px), p1y = vdupq_n_s32(py);
+    int32x4_t q1x = vdupq_n_s32(qx), q1y = vdupq_n_s32(qy);
+    int32x4_t min1x = vminq_s32(p1x, q1x), max1x = vmaxq_s32(p1x, q1x);
+    int32x4_t min1y = vminq_s32(p1y, q1y), max1y = vmaxq_s32(p1y, q1y);
+    int32x4_t dx1 = vsubq_s32(q1x, p1x), dy1 = vsubq_s32(q1y, p1y);
+    int32x4_t zero = vdupq_n_s32(0);
+    int32x4_t range = vdupq_n_s32(BATCHRANGE), minus_range = vdupq_n_s32(-BATCHRANGE);
+    int vector_count = (InBatchRange(px, py) && InBatchRange(qx, qy)) ? (count) : (0);
+    for (; i + 4 <= vector_count; i += 4) {
+        int32x4_t p2x = vmovl_s16(vld1_s16(x1 + i)), p2y = vmovl_s16(vld1_s16(y1 + i));
+        int32x4_t q2x = vmovl_s16(vld1_s16(x2 + i)), q2y = vmovl_s16(vld1_s16(y2 + i));
+        
+        // Quick reject when no bounding boxes overlap
+        int32x4_t min2x = vminq_s32(p2x, q2x), max2x = vmaxq_s32(p2x, q2x);
+        int32x4_t min2y = vminq_s32(p2y, q2y), max2y = vmaxq_s32(p2y, q2y);
+        uint32x4_t apart = vorrq_u32(vorrq_u32(vcgtq_s32(min2x, max1x), vcgtq_s32(min1x, max2x)),
+                                     vorrq_u32(vcgtq_s32(min2y, max1y), vcgtq_s32(min1y, max2y)));
+        uint32x2_t apart_all = vand_u32(vget_low_u32(apart), vget_high_u32(apart));
+        if ((vget_lane_u32(apart_all, 0) & vget_lane_u32(apart_all, 1)) == 0xFFFFFFFF) {
+            memset(result + i, 0, 4);
+            continue;
+        }
+        uint32x4_t outside = vorrq_u32(vorrq_u32(vcgtq_s32(max2x, range), vcltq_s32(min2x, minus_range)),
+                                       vorrq_u32(vcgtq_s32(max2y, range), vcltq_s32(min2y, minus_range)));
+        uint32x2_t outside_any = vorr_u32(vget_low_u32(outside), vget_high_u32(outside));
+        if ((vget_lane_u32(outside_any, 0) | vget_lane_u32(outside_any, 1)) != 0) {
+            for (int k = 0; k < 4; k++) {
+                result[i + k] = SegmentsIntersect(px, py, qx, qy, x1[i + k], y1[i + k], x2[i + k], y2[i + k]);
+            }
+            continue;
+        }
+        
+        // OrientationSign() of all four triples as values, not signs
+        int32x4_t dx2 = vsubq_s32(q2x, p2x), dy2 = vsubq_s32(q2y, p2y);
+        int32x4_t o1 = vmlsq_s32(vmulq_s32(dy1, vsubq_s32(p2x, q1x)), dx1, vsubq_s32(p2y, q1y));
+        int32x4_t o2 = vmlsq_s32(vmulq_s32(dy1, vsubq_s32(q2x, q1x)), dx1, vsubq_s32(q2y, q1y));
+        int32x4_t o3 = vmlsq_s32(vmulq_s32(dy2, vsubq_s32(p1x, q2x)), dx2, vsubq_s32(p1y, q2y));
+        int32x4_t o4 = vmlsq_s32(vmulq_s32(dy2, vsubq_s32(q1x, q2x)), dx2, vsubq_s32(q1y, q2y));
+        
+        // General case, orientations differ in sign
+        uint32x4_t differ12 = vorrq_u32(veorq_u32(vcgtq_s32(o1, zero), vcgtq_s32(o2, zero)),
+                                        veorq_u32(vcltq_s32(o1, zero), vcltq_s32(o2, zero)));
+        uint32x4_t differ34 = vorrq_u32(veorq_u32(vcgtq_s32(o3, zero), vcgtq_s32(o4, zero)),
+                                        veorq_u32(vcltq_s32(o3, zero), vcltq_s32(o4, zero)));
+        uint32x4_t hit = vandq_u32(differ12, differ34);
+        
+        // Special cases, colinear point lying inside the other bounding box
+        uint32x4_t in_p2 = vandq_u32(vandq_u32(vcleq_s32(p2x, max1x), vcgeq_s32(p2x, min1x)),
+                                     vandq_u32(vcleq_s32(p2y, max1y), vcgeq_s32(p2y, min1y)));
+        uint32x4_t in_q2 = vandq_u32(vandq_u32(vcleq_s32(q2x, max1x), vcgeq_s32(q2x, min1x)),
+                                     vandq_u32(vcleq_s32(q2y, max1y), vcgeq_s32(q2y, min1y)));
+        uint32x4_t in_p1 = vandq_u32(vandq_u32(vcleq_s32(p1x, max2x), vcgeq_s32(p1x, min2x)),
+                                     vandq_u32(vcleq_s32(p1y, max2y), vcgeq_s32(p1y, min2y)));
+        uint32x4_t in_q1 = vandq_u32(vandq_u32(vcleq_s32(q1x, max2x), vcgeq_s32(q1x, min2x)),
+                                     vandq_u32(vcleq_s32(q1y, max2y), vcgeq_s32(q1y, min2y)));
+        hit = vorrq_u32(hit, vandq_u32(in_p2, vceqq_s32(o1, zero)));
+        hit = vorrq_u32(hit, vandq_u32(in_q2, vceqq_s32(o2, zero)));
+        hit = vorrq_u32(hit, vandq_u32(in_p1, vceqq_s32(o3, zero)));
+        hit = vorrq_u32(hit, vandq_u32(in_q1, vceqq_s32(o4, zero)));
+        
+        result[i] = vgetq_lane_u32(hit, 0) & 1;
+        result[i + 1] = vgetq_lane_u32(hit, 1) & 1;
+        result[i + 2] = vgetq_lane_u32(hit, 2) & 1;
+        result[i + 3] = vgetq_lane_u32(hit, 3) & 1;
+    }
+#endif
+    
+    // Scalar reference, also handles what is left after the vector loop
+    Point p1 = {px, py}, q1 = {qx, qy};
+    for (; i < count; i++) {
+        Point p2 = {x1[i], y1[i]}, q2 = {x2[i], y2[i]};
+        result[i] = DoIntersect(p1, q1, p2, q2);
+    }
+}
+
+bool InBatchRange(int16_t x, int16_t y) {
+    return x >= -BATCHRANGE && x <= BATCHRANGE && y >= -BATCHRANGE && y <= BATCHRANGE;
+}
+
+void AllocateNodes(Graph *g, int num_of_nodes) {
+    delete[] g->x;
+    delete[] g->y;
+    g->num_of_nodes = num_of_nodes;
+    g->x = new int16_t[num_of_nodes];
+    g->y = new int16_t[num_of_nodes];
+}
+
+void AllocateEdges(Graph *g, int num_of_edges) {
+    delete[] g->node1;
+    delete[] g->node2;
+    g->num_of_edges = num_of_edges;
+    g->node1 = new uint16_t[num_of_edges];
+    g->node2 = new uint16_t[num_of_edges];
+}
+
+Point GraphNode(int node) {
+    Point p = {graph.x[node], graph.y[node]};
+    return p;
+}
+
+bool EdgesShareNode(int i, int j) {
+    uint16_t a1 = graph.node1[i], a2 = graph.node2[i];
+    uint16_t b1 = graph.node1[j], b2 = graph.node2[j];
+    return a1 == b1 || a1 == b2 || a2 == b1 || a2 == b2;
+}
+
+bool EdgesCross(int i, int j) {
+    // Edges which have a common node never cross
+    if (EdgesShareNode(i, j)) {
+        return false;
+    }
+    return DoIntersect(GraphNode(graph.node1[i]), GraphNode(graph.node2[i]), GraphNode(graph.node1[j]), GraphNode(graph.node2[j]));
+}
+
+int NumOfIntersections() {
+#if defined(__AVX2__) || defined(__SSE4_1__) || defined(__ARM_NEON)
+    // Vector batches test every pair faster than the sweep can skip them
+    return NumOfIntersectionsBruteForce();
+#else
+    // Sorting pays off only when there are many edges
+    if (graph.num_of_edges < SWEEPTHRESHOLD) {
+        return NumOfIntersectionsBruteForce();
+    }
+    return NumOfIntersectionsSweep();
+#endif
+}
+
+int NumOfIntersectionsBruteForce() {
+    int num_of_intersections = 0;
+
+    memset(edge_crossings, 0, graph.num_of_edges * edge_words * sizeof(uint32_t));
+    for (int i = 0; i < graph.num_of_edges - 1; i++) {
+        // Test the edge against all edges after it at once
+        int count = graph.num_of_edges - i - 1;
+        IntersectBatch(edge_x1[i], edge_y1[i], edge_x2[i], edge_y2[i],
+                       edge_x1 + i + 1, edge_y1 + i + 1, edge_x2 + i + 1, edge_y2 + i + 1, count, batch_results);
+        
+        for (int j = 0; j < count; j++) {
+            // Remember crossing state of the pair for later updates, edges
+            // which have a common node never cross
+            if (batch_results[j] && !EdgesShareNode(i, i + 1 + j)) {
+                SetCrossing(i, i + 1 + j);
+                num_of_intersections++;
+            }
+        }
+    }
+
+    return num_of_intersections;
+}
+
+int CompareEdgesMinX(const void *a, const void *b) {
+    int i = *(const int *)a, j = *(const int *)b;
+    return min(graph.x[graph.node1[i]], graph.x[graph.node2[i]]) - min(graph.x[graph.node1[j]], graph.x[graph.node2[j]]);
+}
+
+int NumOfIntersectionsSweep() {
+    int num_of_intersections = 0;
+
+    // Pairs that are never tested below do not cross
+    memset(edge_crossings, 0, graph.num_of_edges * edge_words * sizeof(uint32_t));
+
+    // Sweep a vertical line from left to right over the edges
+    for (int i = 0; i < graph.num_of_edges; i++) {
+        sweep_order[i] = i;
+    }
+    qsort(sweep_order, graph.num_of_edges, sizeof(int), CompareEdgesMinX);
+
+    for (int i = 0; i < graph.num_of_edges; i++) {
+        int p = sweep_order[i];
+        uint16_t p1 = graph.node1[p], p2 = graph.node2[p];
+        int16_t max_x = max(graph.x[p1], graph.x[p2]);
+        int16_t min_y = min(graph.y[p1], graph.y[p2]);
+        int16_t max_y = max(graph.y[p1], graph.y[p2]);
+
+        // Only edges starting before p ends can touch it
+        for (int j = i + 1; j < graph.num_of_edges; j++) {
+            int q = sweep_order[j];
+            uint16_t q1 = graph.node1[q], q2 = graph.node2[q];
+            if (min(graph.x[q1], graph.x[q2]) > max_x) {
+                break;
+            }
+            if (min(graph.y[q1], graph.y[q2]) > max_y || max(graph.y[q1], graph.y[q2]) < min_y) {
+                continue;
+            }
+
+            if (EdgesCross(p, q)) {
+                SetCrossing(p, q);
+                num_of_intersections++;
+            }
+        }
+    }
+
+    return num_of_intersections;
+}
+
+void InitIntersections() {
+    // Size the crossing state, the incident edges and the grids for the current graph
+    delete[] edge_crossings;
+    delete[] incident_offsets;
+    delete[] incident_edges;
+    delete[] sweep_order;
+    delete[] grid_edges;
+    delete[] edge_cells;
+    delete[] edge_candidates;
+    delete[] grid_nodes;
+    delete[] node_cells;
+    delete[] edge_x1;
+    delete[] edge_y1;
+    delete[] edge_x2;
+    delete[] edge_y2;
+    delete[] batch_results;
+    edge_words = (graph.num_of_edges + 31) / 32;
+    edge_crossings = new uint32_t[graph.num_of_edges * edge_words];
+    incident_offsets = new int[graph.num_of_nodes + 1];
+    incident_edges = new uint16_t[2 * graph.num_of_edges];
+    sweep_order = new int[graph.num_of_edges];
+    grid_edges = new uint32_t[GRIDSIZE * GRIDSIZE * edge_words];
+    edge_cells = new GridRange[graph.num_of_edges];
+    edge_candidates = new uint32_t[edge_words];
+    node_words = (graph.num_of_nodes + 31) / 32;
+    grid_nodes = new uint32_t[GRIDSIZE * GRIDSIZE * node_words];
+    node_cells = new uint8_t[graph.num_of_nodes];
+    edge_x1 = new int16_t[graph.num_of_edges];
+    edge_y1 = new int16_t[graph.num_of_edges];
+    edge_x2 = new int16_t[graph.num_of_edges];
+    edge_y2 = new int16_t[graph.num_of_edges];
+    batch_results = new uint8_t[graph.num_of_edges];
+
+    // Find edges incident to every node
+    for (int i = 0; i <= graph.num_of_nodes; i++) {
+        incident_offsets[i] = 0;
+    }
+    for (int i = 0; i < graph.num_of_edges; i++) {
+        incident_offsets[graph.node1[i] + 1]++;
+        incident_offsets[graph.node2[i] + 1]++;
+    }
+    for (int i = 0; i < graph.num_of_nodes; i++) {
+        incident_offsets[i + 1] += incident_offsets[i];
+    }
+    for (int i = 0; i < graph.num_of_edges; i++) {
+        incident_edges[incident_offsets[graph.node1[i]]++] = i;
+        incident_edges[incident_offsets[graph.node2[i]]++] = i;
+    }
+    for (int i = graph.num_of_nodes; i > 0; i--) {
+        incident_offsets[i] = incident_offsets[i - 1];
+    }
+    incident_offsets[0] = 0;
+
+    // Put all edges in the grid, its cells grow so that it covers the world
+    ScreenRect world = PuzzleWorld(graph.num_of_nodes);
+    grid_cell_size = max(GRIDCELLSIZE, (max(world.x2, world.y2) + GRIDSIZE) / GRIDSIZE);
+    memset(grid_edges, 0, GRIDSIZE * GRIDSIZE * edge_words * sizeof(uint32_t));
+    for (int i = 0; i < graph.num_of_edges; i++) {
+        UpdateEdgePoints(i);
+        uint16_t node1 = graph.node1[i], node2 = graph.node2[i];
+        edge_cells[i] = GridRangeOf(graph.x[node1], graph.y[node1], graph.x[node2], graph.y[node2]);
+        GridSetEdge(i, true);
+    }
+    
+    // Put all nodes in the grid
+    memset(grid_nodes, 0, GRIDSIZE * GRIDSIZE * node_words * sizeof(uint32_t));
+    for (int i = 0; i < graph.num_of_nodes; i++) {
+        node_cells[i] = GridCellOf(graph.x[i], graph.y[i]);
+        grid_nodes[node_cells[i] * node_words + (i >> 5)] |= 1u << (i & 31);
+    }
+
+    num_of_crossings = NumOfIntersections();
+}
+
+int UpdateIntersections(int node) {
+    // The crossing state is only changed on the main thread, tickers post
+    // events for HandleTimerEvents() instead of moving nodes themselves
+    MBED_ASSERT(!core_util_is_isr_active());
+    GridUpdateNode(node);
+    for (int i = incident_offsets[node]; i < incident_offsets[node + 1]; i++) {
+        UpdateEdgePoints(incident_edges[i]);
+        GridUpdateEdge(incident_edges[i]);
+    }
+
+    // Only pairs containing an edge incident to the moved node can change and
+    // only edges sharing a grid cell with such an edge can cross it
+    for (int i = incident_offsets[node]; i < incident_offsets[node + 1]; i++) {
+        int edge = incident_edges[i];
+        uint16_t node1 = graph.node1[edge], node2 = graph.node2[edge];
+        GridEdgesInRect(min(graph.x[node1], graph.x[node2]), min(graph.y[node1], graph.y[node2]),
+                        max(graph.x[node1], graph.x[node2]), max(graph.y[node1], graph.y[node2]), edge_candidates);
+
+        uint32_t *row = edge_crossings + edge * edge_words;
+        for (int w = 0; w < edge_words; w++) {
+            uint32_t crossings = 0;
+            for (uint32_t bits = edge_candidates[w]; bits != 0; bits &= bits - 1) {
+                int q = 32 * w + __builtin_ctz(bits);
+                if (EdgesCross(edge, q)) {
+                    crossings |= 1u << (q & 31);
+                }
+            }
+
+            // Apply the pairs whose state changed to both rows
+            for (uint32_t changed = crossings ^ row[w]; changed != 0; changed &= changed - 1) {
+                int q = 32 * w + __builtin_ctz(changed);
+                edge_crossings[q * edge_words + (edge >> 5)] ^= 1u << (edge & 31);
+                num_of_crossings += (crossings & (1u << (q & 31))) ? (1) : (-1);
+            }
+            row[w] = crossings;
+        }
+    }
+
+    return num_of_crossings;
+}
+
+void UpdateEdgePoints(int edge) {
+    edge_x1[edge] = graph.x[graph.node1[edge]];
+    edge_y1[edge] = graph.y[graph.node1[edge]];
+    edge_x2[edge] = graph.x[graph.node2[edge]];
+    edge_y2[edge] = graph.y[graph.node2[edge]];
+}
+
+void SetCrossing(int i, int j) {
+    edge_crossings[i * edge_words + (j >> 5)] |= 1u << (j & 31);
+    edge_crossings[j * edge_words + (i >> 5)] |= 1u << (i & 31);
+}
+
+GridRange GridRangeOf(int16_t x1, int16_t y1, int16_t x2, int16_t y2) {
+    // Cells covered by the rectangle, clamped to the grid
+    GridRange range;
+    range.x1 = min(max(min(x1, x2) / grid_cell_size, 0), GRIDSIZE - 1);
+    range.y1 = min(max(min(y1, y2) / grid_cell_size, 0), GRIDSIZE - 1);
+    range.x2 = min(max(max(x1, x2) / grid_cell_size, 0), GRIDSIZE - 1);
+    range.y2 = min(max(max(y1, y2) / grid_cell_size, 0), GRIDSIZE - 1);
+    return range;
+}
+
+void GridSetEdge(int edge, bool present) {
+    GridRange range = edge_cells[edge];
+    for (int i = range.y1; i <= range.y2; i++) {
+        for (int j = range.x1; j <= range.x2; j++) {
+            uint32_t *cell = grid_edges + (i * GRIDSIZE + j) * edge_words;
+            if (present) {
+                cell[edge >> 5] |= 1u << (edge & 31);
+            } else {
+                cell[edge >> 5] &= ~(1u << (edge & 31));
+            }
+        }
+    }
+}
+
+void GridUpdateEdge(int edge) {
+    uint16_t node1 = graph.node1[edge], node2 = graph.node2[edge];
+    GridRange range = GridRangeOf(graph.x[node1], graph.y[node1], graph.x[node2], graph.y[node2]);
+    if (range.x1 == edge_cells[edge].x1 && range.y1 == edge_cells[edge].y1 &&
+        range.x2 == edge_cells[edge].x2 && range.y2 == edge_cells[edge].y2) {
+        return;
+    }
+
+    GridSetEdge(edge, false);
+    edge_cells[edge] = range;
+    GridSetEdge(edge, true);
+}
+
+void GridEdgesInRect(int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint32_t *result) {
+    // Collect edges from every cell the rectangle touches
+    GridRange range = GridRangeOf(x1, y1, x2, y2);
+    memset(result, 0, edge_words * sizeof(uint32_t));
+    for (int i = range.y1; i <= range.y2; i++) {
+        for (int j = range.x1; j <= range.x2; j++) {
+            uint32_t *cell = grid_edges + (i * GRIDSIZE + j) * edge_words;
+            for (int w = 0; w < edge_words; w++) {
+                result[w] |= cell[w];
+            }
+        }
+    }
 }
 
-void DrawGraph() {
-    BSP_LCD_Clear((themes + theme_selected)->color1);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-    
-    // Draw all edges
-    for (Edge *p = edges; p < edges + num_of_edges; p++) {
-        BSP_LCD_DrawLine(p->point1->X, p->point1->Y, p->point2->X, p->point2->Y);   
+int GridCellOf(int16_t x, int16_t y) {
+    GridRange range = GridRangeOf(x, y, x, y);
+    return range.y1 * GRIDSIZE + range.x1;
+}
+
+void GridUpdateNode(int node) {
+    int cell = GridCellOf(graph.x[node], graph.y[node]);
+    if (cell == node_cells[node]) {
+        return;
     }
     
-    // Draw all nodes
-    for (pPoint p = nodes; p < nodes + NUMOFNODES; p++) {
-        BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-        BSP_LCD_FillCircle(p->X, p->Y, 5);
-        BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-        BSP_LCD_DrawCircle(p->X, p->Y, 5);
-    }
+    grid_nodes[node_cells[node] * node_words + (node >> 5)] &= ~(1u << (node & 31));
+    node_cells[node] = cell;
+    grid_nodes[cell * node_words + (node >> 5)] |= 1u << (node & 31);
 }
 
-// Function taken from: https://www.geeksforgeeks.org/check-if-two-given-line-segments-intersect/
-int Orientation(Point p, Point q, Point r) {
-    int val = (q.Y - p.Y) * (r.X - q.X) -
-              (q.X - p.X) * (r.Y - q.Y);
-  
-    if (val == 0) return 0;  // colinear
-  
-    return (val > 0) ? 1: 2; // clock or counterclock wise
+void ClassicTimer() {
+    PostTimerEvent(TIMER_CLASSIC);
 }
 
-// Function taken from: https://www.geeksforgeeks.org/check-if-two-given-line-segments-intersect/
-bool OnSegment(Point p, Point q, Point r) {
-    if (q.X <= max(p.X, r.X) && q.X >= min(p.X, r.X) &&
-        q.Y <= max(p.Y, r.Y) && q.Y >= min(p.Y, r.Y))
-       return true;
-  
-    return false;
+void RaceAgainstTimeTimer() {
+    PostTimerEvent(TIMER_RACE_AGAINST_TIME);
 }
 
-// Function taken from: https://www.geeksforgeeks.org/check-if-two-given-line-segments-intersect/
-bool DoIntersect(Point p1, Point q1, Point p2, Point q2) {
-    // Find the four Orientations needed for general and
-    // special cases
-    int o1 = Orientation(p1, q1, p2);
-    int o2 = Orientation(p1, q1, q2);
-    int o3 = Orientation(p2, q2, p1);
-    int o4 = Orientation(p2, q2, q1);
-  
-    // General case
-    if (o1 != o2 && o3 != o4)
-        return true;
-        
-    // Special Cases
-    // p1, q1 and p2 are colinear and p2 lies on segment p1q1
-    if (o1 == 0 && OnSegment(p1, p2, q1)) return true;
-  
-    // p1, q1 and q2 are colinear and q2 lies on segment p1q1
-    if (o2 == 0 && OnSegment(p1, q2, q1)) return true;
-  
-    // p2, q2 and p1 are colinear and p1 lies on segment p2q2
-    if (o3 == 0 && OnSegment(p2, p1, q2)) return true;
-  
-     // p2, q2 and q1 are colinear and q1 lies on segment p2q2
-    if (o4 == 0 && OnSegment(p2, q1, q2)) return true;
-  
-    return false; // Doesn't fall in any of the above cases
+void PostTimerEvent(int event) {
+    // Called from interrupts, the work is left to the main thread
+    timer_events_posted[event]++;
+    TouchWake();
 }
 
-int NumOfIntersections() {
-    int num_of_intersections = 0;
-    
-    for (Edge *p = edges; p < edges + num_of_edges; p++) {
-        for (Edge *q = p + 1; q < edges + num_of_edges; q++) {
-            // Do not count edges which hava a commen node
-            if (p->point1 == q->point1 || p->point1 == q->point2 || p->point2 == q->point1 || p->point2 == q->point2) {
-                continue;
-            }
-            num_of_intersections += DoIntersect(*(p->point1), *(p->point2), *(q->point1), *(q->point2));
-        }  
+void DropTimerEvents() {
+    for (int i = 0; i < NUMOFTIMEREVENTS; i++) {
+        timer_events_handled[i] = timer_events_posted[i];
     }
-    
-    return num_of_intersections;
 }
 
-void ClassicTimer() {
-    char buffer_timer[50];
-    sprintf(buffer_timer, "Time elapsed: %ds   ", ++t);
-    
-    BSP_LCD_SetFont(&Font12);
-    BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-    BSP_LCD_DisplayStringAt(0, 24, (uint8_t *)buffer_timer, LEFT_MODE);
-    
-    BSP_LCD_SetTextColor((themes + theme_selected)->color1);
-    BSP_LCD_FillRect(140, 24, BSP_LCD_GetXSize() - 130, 12);
+void HandleTimerEvents() {
+    void (*handlers[NUMOFTIMEREVENTS])() = {ClassicTick, RaceAgainstTimeTick, MoveRandomNode};
+    
+    // Events posted while the main thread was busy are all handled now
+    for (int i = 0; i < NUMOFTIMEREVENTS; i++) {
+        while (timer_events_handled[i] != timer_events_posted[i]) {
+            timer_events_handled[i]++;
+            handlers[i]();
+        }
+    }
 }
 
-void RaceAgainstTimeTimer() {
-    char buffer_timer[50];
-    sprintf(buffer_timer, "Time remaining: %ds   ", --t);
-    BSP_LCD_SetFont(&Font12);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-    BSP_LCD_DisplayStringAt(0, 24, (uint8_t *)buffer_timer, LEFT_MODE);
+void StopTimers() {
+    ticker.detach();
+    ticker2.detach();
+    DropTimerEvents();
+}
+
+void ClassicTick() {
+    HudSetValue(HUD_TIME, ++t);
+    FlushFramebuffer();
+}
+
+void RaceAgainstTimeTick() {
+    HudSetValue(HUD_TIME, --t);
     
-    BSP_LCD_SetTextColor((themes + theme_selected)->color1);
-    BSP_LCD_FillRect(140, 24, BSP_LCD_GetXSize() - 130, 12);    
+    if (t == 0) {
+        ShowStatus("You ran out of time! :(", &Font12);
+        StopTimers();
+    }
+    FlushFramebuffer();
 }
 
 int Singleplayer(int gamemode) {
-    int level;
+    int level = NORMALLEVEL;
 
     // Set initial time for timer
     if (gamemode == 1) {
@@ -298,35 +1753,38 @@ int Singleplayer(int gamemode) {
         t = 0;
     }
     
-    GenerateGraph();
+    // Easy, normal and hard puzzles are made of 4, 5 and 6 lines
+    PoolTake(level);
     
     // Draw graph and information 
     DrawGraph();
-    char buffer[50];
-    sprintf(buffer, "Number of line crossings: %d", NumOfIntersections());
-    BSP_LCD_SetFont(&Font12);
-    BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-    BSP_LCD_DisplayStringAt(0, 0, (uint8_t *)buffer, LEFT_MODE);
-    BSP_LCD_DisplayStringAt(0, 12, (uint8_t *)"Moves taken: 0", LEFT_MODE);
-    if (gamemode == 1 || gamemode == 3) {
-        BSP_LCD_DisplayStringAt(0, 24, (uint8_t *)"Time elapsed: 0s", LEFT_MODE);
-    } else if (gamemode == 2) {
-        char buffer_[50];
-        sprintf(buffer_, "Time remaining: %ds", t);
-        BSP_LCD_DisplayStringAt(0, 24, (uint8_t *)buffer_, LEFT_MODE);
-    }
+    HudInit((gamemode == 2) ? ("Time remaining: ") : ("Time elapsed: "));
+    HudSetValue(HUD_CROSSINGS, num_of_crossings);
+    HudSetValue(HUD_MOVES, 0);
+    HudSetValue(HUD_TIME, t);
     
     // Draw back button
-    BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-    BSP_LCD_FillRect(219, 0, 20, 20);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-    BSP_LCD_DrawRect(219, 0, 20, 20);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color1);
-    Point back[3] = {{224, 10}, {234, 4}, {234, 16}};
-    BSP_LCD_FillPolygon(back, 3);
+    FB_SetTextColor((themes + theme_selected)->color3);
+    FB_FillRect(219, 0, 20, 20);
+    FB_SetTextColor((themes + theme_selected)->color2);
+    FB_DrawRect(219, 0, 20, 20);
+    FB_SetTextColor((themes + theme_selected)->color1);
+    FB_Point back[3] = {{224, 10}, {234, 4}, {234, 16}};
+    FB_FillPolygon(back, 3);
+    
+    // Draw hint button
+    FB_SetTextColor((themes + theme_selected)->color3);
+    FB_FillRect(184, 22, 34, 13);
+    FB_SetTextColor((themes + theme_selected)->color2);
+    FB_DrawRect(184, 22, 34, 13);
+    FB_SetTextColor((themes + theme_selected)->color1);
+    FB_SetBackColor((themes + theme_selected)->color3);
+    FB_SetFont(&Font12);
+    FB_DisplayStringAt(187, 23, (uint8_t *)"Hint", FB_LEFT_MODE);
+    FlushFramebuffer();
     
     // Set tickers
+    DropTimerEvents();
     if (gamemode == 1) {
         ticker.attach(ClassicTimer, 1);
     } else if (gamemode == 2) {
@@ -337,108 +1795,99 @@ int Singleplayer(int gamemode) {
     }
     
     num_of_moves = 0;
+    bool solved_shown = false;
+    status_text = NULL;
+    hint.active = false;
+    hint.shown = false;
     while (true) {
-        if (gamemode == 2 && t == 0) {
-                BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-                BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-                BSP_LCD_SetFont(&Font12);
-                BSP_LCD_DisplayStringAt(0, 227, (uint8_t *)"You ran out of time! :(", CENTER_MODE);
-                ticker.detach();
-        }      
+        HandleTimerEvents();
+        
+        // The hint search runs while no touch is waiting
+        if (hint.active && HintStep()) {
+            HintShow();
+            FlushFramebuffer();
+        }
         
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (TouchWait(&event, (hint.active) ? (0) : (TOUCHFOREVER)) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
 
             if (x >= 219 && x <= 239 && y >= 0 && y <= 20) {
-                ticker.detach();
-                ticker2.detach();
+                StopTimers();
+                HintClear();
                 break;
             }            
             
-            for (pPoint p = nodes; p < nodes + NUMOFNODES; p++) {
-                // Check if the pressed point is part of some node 
-                if ((x - p->X) * (x - p->X) + (y - p->Y) * (y - p->Y) <= 25) {
-                    if (NumOfIntersections() != 0) {
-                        num_of_moves++;
-                    }
+            if (x >= 184 && x <= 217 && y >= 22 && y <= 35) {
+                // A new search replaces the hint on the screen
+                if (num_of_crossings != 0) {
+                    HintClear();
+                    FlushFramebuffer();
+                    HintStart();
+                }
+                continue;
+            }
+            
+            // Check if the pressed point is part of some node, two fingers
+            // and the empty part of the view move the view
+            int node = NodeAt(x, y);
+            if (event.count == 2 || node == -1) {
+                if (event.count == 2 || y >= VIEWY1) {
+                    ViewGesture(&event);
+                }
+                continue;
+            }
+            
+            if (num_of_crossings != 0) {
+                num_of_moves++;
+            }
+            
+            while (NextDragSample(&event)) {
+                // Check if the new node is in the world
+                int16_t world_x, world_y;
+                if (ViewWorldPoint(event.x, event.y, &world_x, &world_y)) {
+                    // Draw the part of the graph changed by the moved point
+                    int num_of_intersections = MoveNode(node, world_x, world_y);
                     
-                    while (true) {
-                        BSP_TS_GetState(&TS_State); 
-                        if (!TS_State.touchDetected) {
-                           break;
-                        }                        
-                        
-                        x = TS_State.touchX[0];
-                        y = TS_State.touchY[0];
-                        
-                        // Check if the new node is on the screen 
-                        if (x >= 5 && x <= 234 && y >= 41 && y <= 234) {
-                            // Draw graph with moved point
-                            p->X = x;
-                            p->Y = y;
-                            DrawGraph();
-                            
-                            // Draw back button
-                            BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-                            BSP_LCD_FillRect(219, 0, 20, 20);
-                            BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-                            BSP_LCD_DrawRect(219, 0, 20, 20);
-                            BSP_LCD_SetTextColor((themes + theme_selected)->color1);
-                            Point back[3] = {{224, 10}, {234, 4}, {234, 16}};
-                            BSP_LCD_FillPolygon(back, 3);
-                            
-                            // Chech whether the puzzle is solved
-                            int num_of_intersections = NumOfIntersections();
-                            if (num_of_intersections == 0) {
-                                ticker.detach();
-                                ticker2.detach();
-                                BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-                                BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-                                BSP_LCD_SetFont(&Font12);
-                                BSP_LCD_DisplayStringAt(0, 227, (uint8_t *)"You have solved the puzzle! :)", CENTER_MODE);
-
-                                // Calculate score and update highscore if necessary
-                                if(gamemode == 1) {
-                                    int score = t + num_of_moves;
-                                    if ((players_highscores + current_player)->classic == -1 || (players_highscores + current_player)->classic > score) {
-                                        (players_highscores + current_player)->classic = score;
-                                    }
-                                } else if (gamemode == 2) {
-                                    int score = (60 + num_of_moves) * (4 - level) - t;
-                                    if ((players_highscores + current_player)->race_against_time == -1 || (players_highscores + current_player)->race_against_time > score) {
-                                        (players_highscores + current_player)->race_against_time = score;
-                                    }
-                                }else if (gamemode == 3) {
-                                    int score = t + num_of_moves * (4 - level);
-                                    if ((players_highscores + current_player)->crazy == -1 || (players_highscores + current_player)->crazy > score) {
-                                        (players_highscores + current_player)->crazy = score;
-                                    }
-                                }                            
+                    // Chech whether the puzzle is solved
+                    if (num_of_intersections != 0 && solved_shown) {
+                        ClearStatus();
+                        solved_shown = false;
+                    }
+                    if (num_of_intersections == 0) {
+                        solved_shown = true;
+                        StopTimers();
+                        ShowStatus("You have solved the puzzle! :)", &Font12);
+
+                        // Calculate score and update highscore if necessary
+                        if(gamemode == 1) {
+                            int score = t + num_of_moves;
+                            if ((players_highscores + current_player)->classic == -1 || (players_highscores + current_player)->classic > score) {
+                                (players_highscores + current_player)->classic = score;
                             }
-                            
-                            // Print information
-                            char buffer1[50], buffer2[50], buffer3[50];
-                            sprintf(buffer1, "Number of line crossings: %d", num_of_intersections);
-                            sprintf(buffer2, "Moves taken: %d", num_of_moves);
-                            if (gamemode == 1 || gamemode == 3){
-                                sprintf(buffer3, "Time elapsed: %ds", t);
-                            } else if (gamemode == 2) {
-                                sprintf(buffer3, "Time remaining: %ds", t);
+                        } else if (gamemode == 2) {
+                            int score = (60 + num_of_moves) * (4 - level) - t;
+                            if ((players_highscores + current_player)->race_against_time == -1 || (players_highscores + current_player)->race_against_time > score) {
+                                (players_highscores + current_player)->race_against_time = score;
                             }
-                            BSP_LCD_SetFont(&Font12);
-                            BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-                            BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-                            BSP_LCD_DisplayStringAt(0, 0, (uint8_t *)buffer1, LEFT_MODE);
-                            BSP_LCD_DisplayStringAt(0, 12, (uint8_t *)buffer2, LEFT_MODE);
-                            BSP_LCD_DisplayStringAt(0, 24, (uint8_t *)buffer3, LEFT_MODE);
-                        }
+                        }else if (gamemode == 3) {
+                            int score = t + num_of_moves * (4 - level);
+                            if ((players_highscores + current_player)->crazy == -1 || (players_highscores + current_player)->crazy > score) {
+                                (players_highscores + current_player)->crazy = score;
+                            }
+                        }                            
                     }
-                    break;
+                    
+                    // Print information
+                    HudSetValue(HUD_CROSSINGS, num_of_intersections);
+                    HudSetValue(HUD_MOVES, num_of_moves);
+                    
+                    // Send the whole frame to the LCD at once
+                    FlushFramebuffer();
+                    FramePresented(event.time_us);
                 }
             }
-            wait_us(1);
         }
     }
     
@@ -468,10 +1917,10 @@ int MainScreen() {
     
     // Option selector
     while (true) {
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (MenuTouchWait(&event) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 53 && x <= 185 && y >= 59 && y <= 84) {
                 return 3;
@@ -483,7 +1932,6 @@ int MainScreen() {
                 return 6;
             }
         }
-        wait_us(1);
     }
 }
 
@@ -523,10 +1971,10 @@ int Gamemodes() {
     // Option selector
     wait(0.5);
     while (true) {
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (MenuTouchWait(&event) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 23 && x <= 215 && y >= 59 && y <= 84) {
                 return 1;
@@ -538,7 +1986,6 @@ int Gamemodes() {
                 return 4;
             }            
         }
-        wait_us(1);
     }
 }
 
@@ -572,10 +2019,10 @@ int LevelSelection() {
     // Option selector
     wait(0.5);
     while (true) {
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (MenuTouchWait(&event) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 53 && x <= 185 && y >= 59 && y <= 84) {
                 return 1;
@@ -587,47 +2034,25 @@ int LevelSelection() {
                 return -1;
             }            
         }
-        wait_us(1);
     }
 }
 
 void RandomNodeChange() {
+    PostTimerEvent(TIMER_RANDOM_NODE);
+}
+
+void MoveRandomNode() {
     // Get random node and random coordinates
-    int16_t random_node = rand() % (NUMOFNODES + 1); 
-    int16_t random_x = rand() % 230 + 5;
-    int16_t random_y = rand() % 194 + 41;
+    int16_t random_node = RandomBelow(&crazy_random, graph.num_of_nodes);
+    int16_t random_x = RandomBelow(&crazy_random, view.world.x2 - view.world.x1 + 1) + view.world.x1;
+    int16_t random_y = RandomBelow(&crazy_random, view.world.y2 - view.world.y1 + 1) + view.world.y1;
     
-    (nodes + random_node)->X = random_x;
-    (nodes + random_node)->Y = random_y;
-    
-    // Draw everything again because coordinates changed
-    DrawGraph();
+    // Draw the part of the graph changed by the moved node
+    MoveNode(random_node, random_x, random_y);
     
     // Print text information
-    BSP_LCD_SetFont(&Font12);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-    BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-    char buffer[50];
-    sprintf(buffer, "Number of line crossings: %d", NumOfIntersections());
-    BSP_LCD_DisplayStringAt(0, 0, (uint8_t *)buffer, LEFT_MODE);
-    sprintf(buffer, "Moves taken: %d   ", num_of_moves);
-    BSP_LCD_DisplayStringAt(0, 12, (uint8_t *)buffer, LEFT_MODE);
-    sprintf(buffer, "Time elapsed: %ds   ", t);
-    BSP_LCD_DisplayStringAt(0, 24, (uint8_t *)buffer, LEFT_MODE);
-    
-    BSP_LCD_SetTextColor((themes + theme_selected)->color1);
-    BSP_LCD_FillRect(200, 0, 18, 12);
-    BSP_LCD_FillRect(120, 12, BSP_LCD_GetXSize() - 142, 12);
-    BSP_LCD_FillRect(140, 24, BSP_LCD_GetXSize() - 130, 12);
-    
-    // Draw back button
-    BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-    BSP_LCD_FillRect(219, 0, 20, 20);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-    BSP_LCD_DrawRect(219, 0, 20, 20);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color1);
-    Point back[3] = {{224, 10}, {234, 4}, {234, 16}};
-    BSP_LCD_FillPolygon(back, 3);     
+    HudSetValue(HUD_CROSSINGS, num_of_crossings);
+    FlushFramebuffer();
 }
 
 int ThemeSelection() {
@@ -660,10 +2085,10 @@ int ThemeSelection() {
     // Option selector
     wait(0.5);
     while (true) {
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (MenuTouchWait(&event) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 53 && x <= 185 && y >= 59 && y <= 84) {
                 theme_selected = 0;
@@ -681,7 +2106,6 @@ int ThemeSelection() {
                 break;
             }            
         }
-        wait_us(1);
     }
     
     return 1;
@@ -711,14 +2135,23 @@ int Multiplayer() {
     Point back[3] = {{224, 10}, {234, 4}, {234, 16}};
     BSP_LCD_FillPolygon(back, 3);
     
+    // Draw why the last match ended
+    if (multiplayer_status != NULL) {
+        BSP_LCD_SetBackColor((themes + theme_selected)->color1);
+        BSP_LCD_SetTextColor((themes + theme_selected)->color3);
+        BSP_LCD_SetFont(&Font12);
+        BSP_LCD_DisplayStringAt(0, 140, (uint8_t *)multiplayer_status, CENTER_MODE);
+        multiplayer_status = NULL;
+    }
+    
     // Option selector
     int choice = 0;
     wait(0.5);
     while (true) {
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (MenuTouchWait(&event) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 53 && x <= 185 && y >= 59 && y <= 84) {
                 choice =  1;
@@ -731,7 +2164,6 @@ int Multiplayer() {
                 break;
             }            
         }
-        wait_us(1);
     }
 
     if (choice == 3) {
@@ -743,38 +2175,22 @@ int Multiplayer() {
     start_host = false;
     start_join = false;
     lost = false;    
+    graph_seq_loaded = 0;
+    match_id = 0;
+    match_sends = 0;
+    offer_device = 0;
+    num_of_lobby_joiners = 0;
     
     // Determine is host or join selected 
     // host -> false
     // join -> true
     host_join = (choice == 1) ? (false) : (true);
     
-    // Setup connection
-    NetworkInterface *network;
-    network = NetworkInterface::get_default_instance();
-    MQTTNetwork mqttNetwork(network);
-    MQTT::Client<MQTTNetwork, Countdown> client(mqttNetwork);
-    const char* hostname = "broker.hivemq.com";
-    int port = 1883;
-    int rc = mqttNetwork.connect(hostname, port);
-    if (rc != 0) {
-        printf("rc from TCP connect is %d\r\n", rc);
-    }
-    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
-    data.MQTTVersion = 3;
-    if (choice == 1) {
-        data.clientID.cstring = "host";
-    } else {
-        data.clientID.cstring = "join";
-    }
-    data.username.cstring = "";
-    data.password.cstring = "";
-    
-    if ((rc = client.connect(data)) != 0) {
-        printf("rc from MQTT connect is %d\r\n", rc);
-    }
-
-    MQTT::Message message;
+    // Setup connection, the network thread wakes this one for every message
+    NetStart(TouchWake);
+#if PROFILE
+    uint32_t setup_start_us = us_ticker_read();
+#endif
     
     // Draw waiting screen
     BSP_LCD_Clear((themes + theme_selected)->color1);
@@ -794,23 +2210,18 @@ int Multiplayer() {
     
     bool back_button_pressed = false;
     
-    // If join is selected send first message
+    // If join is selected ask for a match in the lobby
     if (choice == 2) {
-        char buf[] = "Join";
-        message.qos = MQTT::QOS0;
-        message.retained = false;
-        message.dup = false;
-        message.payload = (void*)buf;
-        message.payloadlen = strlen(buf);
-        rc = client.publish("planarity/connecting", message);        
+        NetSendJoinRequest();
     }
+    lobby_us = us_ticker_read();
     
     // Wait for someone to join
     while (!go_to_ready) {
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (TouchWait(&event, LobbyWaitMs()) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 219 && x <= 239 && y >= 0 && y <= 20) {
                 back_button_pressed = true;
@@ -818,25 +2229,18 @@ int Multiplayer() {
             }
         }        
         
-        // Wait for initial message if host is selected or confirmation message if join is selected
-        rc = client.subscribe("planarity/connecting", MQTT::QOS0, MessageArrivedConnecting);
-        wait_us(1);
+        // Match request or offer, then the confirmation of the match
+        HandleNetworkEvents();
+        LobbyTick();
     }
     
     if (back_button_pressed) {
+        NetStop();
         return 4;
     }
-    
-    // If host is selected send reply/confirmation message
-    if (choice == 1) {
-        char buf[] = "Host";
-        message.qos = MQTT::QOS0;
-        message.retained = false;
-        message.dup = false;
-        message.payload = (void*)buf;
-        message.payloadlen = strlen(buf);
-        rc = client.publish("planarity/connecting", message);            
-    }
+#if PROFILE
+    uint32_t lobby_ms = (us_ticker_read() - setup_start_us) / 1000;
+#endif
 
     // Draw start button
     BSP_LCD_Clear((themes + theme_selected)->color1);
@@ -858,10 +2262,10 @@ int Multiplayer() {
     // Wait for both host and join to press start
     back_button_pressed = false;
     while (!start_host || !start_join) {
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (TouchWait(&event, TOUCHFOREVER) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 82 && x <= 155 && y >= 96 && y <= 121) {
                 if (choice == 1) {
@@ -871,14 +2275,7 @@ int Multiplayer() {
                 }
                 
                 // Send message meaning this player pressed start
-                char buf2[50];
-                (choice == 1) ? (strcpy(buf2, "HostReady")) : (strcpy(buf2, "JoinReady"));
-                message.qos = MQTT::QOS0;
-                message.retained = false;
-                message.dup = false;
-                message.payload = (void*)buf2;
-                message.payloadlen = strlen(buf2);
-                rc = client.publish("planarity/connecting", message);                   
+                NetSendSignal((choice == 1) ? (NET_HOST_READY) : (NET_JOIN_READY));
                 
                 // Draw waiting screen
                 BSP_LCD_SetBackColor((themes + theme_selected)->color1);
@@ -892,424 +2289,613 @@ int Multiplayer() {
             }
         }        
         
-        rc = client.subscribe("planarity/connecting", MQTT::QOS0, MessageArrivedStart);
-        wait_us(1);
+        HandleNetworkEvents();
     }    
     
     if (back_button_pressed) {
+        NetStop();
         return 4;
     }    
 
     // Generate and send graph if host is selected or wait for and load received graph if join is selected
-    GenerateGraph();
-    join_received = 0;
-    if (choice == 1) {
-        wait(1);
-        // Send nodes
-        char sending_nodes[100];
-        for (pPoint p = nodes; p < nodes + NUMOFNODES; p++) {
-            char buf_temp[10];
-            sprintf(buf_temp, "%d,%d;", p->X, p->Y);
-            strcat(sending_nodes, buf_temp);
-        }
-        strcat(sending_nodes, "e");
-        message.qos = MQTT::QOS0;
-        message.retained = false;
-        message.dup = false;
-        message.payload = (void*)sending_nodes;
-        message.payloadlen = strlen(sending_nodes);
-        rc = client.publish("planarity/connecting", message);
-
-        // Wait for confirmation that join has loaded the nodes
-        while (join_received != 1) {
-            rc = client.subscribe("planarity/connecting", MQTT::QOS0, MessageArrivedReceiveConfirmation);
-            wait_us(1);
-        }
-    
-        // Send edges
-        char sending_edges[100];
-        for (Edge *p = edges; p < edges + num_of_edges; p++) {
-            char buf_temp[10];
-            sprintf(buf_temp, "%d,%d;", int(p->point1 - nodes), int(p->point2 - nodes));
-            strcat(sending_edges, buf_temp);
-        }
-        message.qos = MQTT::QOS0;
-        message.retained = false;
-        message.dup = false;
-        message.payload = (void*)sending_edges;
-        message.payloadlen = strlen(sending_edges);
-        rc = client.publish("planarity/connecting", message);  
-        
-        // Wait for confirmation that join has loaded the edges
-        while (join_received != 2) {
-            rc = client.subscribe("planarity/connecting", MQTT::QOS0, MessageArrivedReceiveConfirmation);
-            wait_us(1);            
-        }
-    } else {
-        // Wait for nodes to arrive
-        while(join_received != 1) {
-            rc = client.subscribe("planarity/connecting", MQTT::QOS0, MessageArrivedReceiveNodes);
-            wait_us(1);            
-        }
-        
-        // Send confirmation that the nodes have arrived
-        char buf_rec[] = "Received";
-        message.qos = MQTT::QOS0;
-        message.retained = false;
-        message.dup = false;
-        message.payload = (void*)buf_rec;
-        message.payloadlen = strlen(buf_rec);
-        rc = client.publish("planarity/connecting", message);     
-        
-        // Wait for edges to arrive
-        while(join_received != 2) {
-            rc = client.subscribe("planarity/connecting", MQTT::QOS0, MessageArrivedReceiveNodes);
-            wait_us(1);            
-        }
-        
-        // Send confirmation that the edges have arrived
-        message.qos = MQTT::QOS0;
-        message.retained = false;
-        message.dup = false;
-        message.payload = (void*)buf_rec;
-        message.payloadlen = strlen(buf_rec);
-        rc = client.publish("planarity/connecting", message);          
+#if PROFILE
+    uint32_t sync_start_us = us_ticker_read();
+#endif
+    if (!SyncGraph()) {
+        NetStop();
+        return 4;
     }
+#if PROFILE
+    printf("Match %08lx: lobby %lu ms, graph sync %lu ms\n", (unsigned long)match_id, (unsigned long)lobby_ms,
+           (unsigned long)((us_ticker_read() - sync_start_us) / 1000));
+#endif
     
     // Draw graph and information
     DrawGraph();
-    char buffer[50];
-    sprintf(buffer, "Number of line crossings: %d", NumOfIntersections());
-    BSP_LCD_SetFont(&Font12);
-    BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-    BSP_LCD_DisplayStringAt(0, 0, (uint8_t *)buffer, LEFT_MODE);
-    BSP_LCD_DisplayStringAt(0, 12, (uint8_t *)"Moves taken: 0", LEFT_MODE);
-    BSP_LCD_DisplayStringAt(0, 24, (uint8_t *)"Time elapsed: 0s", LEFT_MODE);
+    HudInit("Time elapsed: ");
+    HudSetValue(HUD_CROSSINGS, num_of_crossings);
+    HudSetValue(HUD_MOVES, 0);
+    HudSetValue(HUD_TIME, 0);
     
     // Draw back button
-    BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-    BSP_LCD_FillRect(219, 0, 20, 20);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-    BSP_LCD_DrawRect(219, 0, 20, 20);
-    BSP_LCD_SetTextColor((themes + theme_selected)->color1);
-    BSP_LCD_FillPolygon(back, 3);
+    FB_SetTextColor((themes + theme_selected)->color3);
+    FB_FillRect(219, 0, 20, 20);
+    FB_SetTextColor((themes + theme_selected)->color2);
+    FB_DrawRect(219, 0, 20, 20);
+    FB_SetTextColor((themes + theme_selected)->color1);
+    FB_Point game_back[3] = {{224, 10}, {234, 4}, {234, 16}};
+    FB_FillPolygon(game_back, 3);
+    FlushFramebuffer();
     
     // Set ticker
     t = 0;
+    DropTimerEvents();
     ticker.attach(ClassicTimer, 1);
     
     lost = false;
+    status_text = NULL;
     while (true) {
+        HandleTimerEvents();
         if (lost) {
-                BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-                BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-                BSP_LCD_SetFont(&Font8);
-                BSP_LCD_DisplayStringAt(0, 227, (uint8_t *)"Your opponent solved the puzzle. You lose :(", CENTER_MODE);
-                ticker.detach();
+                ShowStatus("Your opponent solved the puzzle. You lose :(", &Font8);
+                FlushFramebuffer();
+                StopTimers();
         } 
         
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (TouchWait(&event, TOUCHFOREVER) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 219 && x <= 239 && y >= 0 && y <= 20) {
-                ticker.detach();
+                StopTimers();
                 break;
             }            
             
-            for (pPoint p = nodes; p < nodes + NUMOFNODES; p++) {
-                // Check if the pressed point is part of some node 
-                if ((x - p->X) * (x - p->X) + (y - p->Y) * (y - p->Y) <= 25) {
-                    if (NumOfIntersections() != 0) {
-                        num_of_moves++;
-                    }
-                    
-                    while (true) {
-                        BSP_TS_GetState(&TS_State); 
-                        if (!TS_State.touchDetected) {
-                           break;
-                        }                        
-                        
-                        
-                        x = TS_State.touchX[0];
-                        y = TS_State.touchY[0];
+            // Check if the pressed point is part of some node, two fingers
+            // and the empty part of the view move the view
+            int node = NodeAt(x, y);
+            if (event.count == 2 || node == -1) {
+                if (event.count == 2 || y >= VIEWY1) {
+                    ViewGesture(&event);
+                }
+            } else {
+                if (num_of_crossings != 0) {
+                    num_of_moves++;
+                }
+                
+                while (NextDragSample(&event)) {
+                    // Check if the new node is in the world
+                    int16_t world_x, world_y;
+                    if (ViewWorldPoint(event.x, event.y, &world_x, &world_y)) {
+                        // Draw the part of the graph changed by the moved point
+                        int num_of_intersections = MoveNode(node, world_x, world_y);
                         
-                        // Check if the new node is on the screen 
-                        if (x >= 5 && x <= 234 && y >= 41 && y <= 234) {
-                            // Draw graph with moved point
-                            p->X = x;
-                            p->Y = y;
-                            DrawGraph();
+                        // Chech whether the puzzle is solved
+                        if (num_of_intersections == 0) {
+                            NetSendSignal((choice == 1) ? (NET_HOST_WON) : (NET_JOIN_WON));
                             
-                            // Draw back button
-                            BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-                            BSP_LCD_FillRect(219, 0, 20, 20);
-                            BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-                            BSP_LCD_DrawRect(219, 0, 20, 20);
-                            BSP_LCD_SetTextColor((themes + theme_selected)->color1);
-                            //Point back[3] = {{224, 10}, {234, 4}, {234, 16}};
-                            BSP_LCD_FillPolygon(back, 3);
-                            
-                            // Chech whether the puzzle is solved
-                            int num_of_intersections = NumOfIntersections();
-                            if (num_of_intersections == 0) {
-                                char buf3[50];
-                                (choice == 1) ? (strcpy (buf3, "HostWon")) : (strcpy (buf3, "JoinWon"));
-                                message.qos = MQTT::QOS0;
-                                message.retained = false;
-                                message.dup = false;
-                                message.payload = (void*)buf3;
-                                message.payloadlen = strlen(buf3);
-                                rc = client.publish("planarity/connecting", message);                                 
-                                
-                                ticker.detach();
-                                BSP_LCD_SetTextColor((themes + theme_selected)->color3);
-                                BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-                                BSP_LCD_SetFont(&Font8);
-                                BSP_LCD_DisplayStringAt(0, 227, (uint8_t *)"You have solved the puzzle. You win :)", CENTER_MODE);
-                            }
-                            
-                            // Print text information
-                            char buffer1[50], buffer2[50], buffer3[50];
-                            sprintf(buffer1, "Number of line crossings: %d", num_of_intersections);
-                            sprintf(buffer2, "Moves taken: %d", num_of_moves);
-                            sprintf(buffer3, "Time elapsed: %ds", t);
-                            BSP_LCD_SetFont(&Font12);
-                            BSP_LCD_SetTextColor((themes + theme_selected)->color2);
-                            BSP_LCD_SetBackColor((themes + theme_selected)->color1);
-                            BSP_LCD_DisplayStringAt(0, 0, (uint8_t *)buffer1, LEFT_MODE);
-                            BSP_LCD_DisplayStringAt(0, 12, (uint8_t *)buffer2, LEFT_MODE);
-                            BSP_LCD_DisplayStringAt(0, 24, (uint8_t *)buffer3, LEFT_MODE);
+                            StopTimers();
+                            ShowStatus("You have solved the puzzle. You win :)", &Font8);
                         }
+                        
+                        // Print text information
+                        HudSetValue(HUD_CROSSINGS, num_of_intersections);
+                        HudSetValue(HUD_MOVES, num_of_moves);
+                        
+                        // Send the whole frame to the LCD at once
+                        FlushFramebuffer();
+                        FramePresented(event.time_us);
                     }
-                    break;
                 }
             }
-            wait_us(1);
         }
-        rc = client.subscribe("planarity/connecting", MQTT::QOS0, MessageArrivedOpponent);
+        HandleNetworkEvents();
     }
-        
+    
+    NetStop();
     return 4;
 }
 
-void MessageArrivedConnecting(MQTT::MessageData& md) {
-    MQTT::Message &message = md.message;
-    char* str=(char*)message.payload;
-    
-    if ((!host_join && !strncmp(str,"Join", 4)) || (host_join && !strncmp(str,"Host", 4))) {
-        go_to_ready = true;
+void HandleNetworkEvents() {
+    // Own messages come back from the broker too, only the opponent's count
+    NetEvent event;
+    while (NetPoll(&event)) {
+        if (!host_join && event.type == NET_JOIN) {
+            // Host answers every confirmation, an earlier answer may have been lost
+            NetSendSignal(NET_HOST);
+            if (match_sends == 0) {
+                match_sends = 1;
+                match_sent_us = us_ticker_read();
+            }
+        } else if (!host_join && event.type == NET_JOIN_ACK) {
+            go_to_ready = true;
+        } else if (host_join && event.type == NET_HOST) {
+            // Joiner acknowledges every answer, the host sends it again until then
+            NetSendSignal(NET_JOIN_ACK);
+            go_to_ready = true;
+        } else if (!host_join && event.type == NET_JOIN_REQUEST && match_id == 0) {
+            // LobbyTick() makes the offer unless another host is faster
+            LobbyJoinerSeen(event.device);
+        } else if (!host_join && event.type == NET_HOST_OFFER && match_id == 0) {
+            LobbyJoinerTaken(event.device);
+        } else if (!host_join && event.type == NET_HOST_OFFER && event.device == offer_device && !offer_echoed) {
+            // Another host was faster, the joiner will not confirm this match
+            offer_echoed = true;
+            if (event.match != match_id) {
+                LobbyLeaveMatch();
+            }
+        } else if (host_join && event.type == NET_HOST_OFFER && event.device == NetDeviceId() && match_id == 0) {
+            // First offer wins, the other hosts give theirs up after LOBBYOFFERMS
+            match_id = event.match;
+            NetEnterMatch(match_id, false);
+            NetSendSignal(NET_JOIN);
+            match_sends = 1;
+            match_sent_us = us_ticker_read();
+            lobby_us = us_ticker_read();
+        } else if (event.type == ((host_join) ? (NET_HOST_READY) : (NET_JOIN_READY))) {
+            (host_join) ? (start_host = true) : (start_join = true);
+        } else if (event.type == ((host_join) ? (NET_HOST_WON) : (NET_JOIN_WON))) {
+            lost = true;
+        } else if (host_join && (event.type == NET_GRAPH || event.type == NET_GRAPH_DAMAGED)) {
+            ReceiveGraph(event);
+        } else if (!host_join && event.type == NET_GRAPH_ACK && event.seq == graph_seq_sent) {
+            if (event.status == 0) {
+                graph_acked = true;
+            } else {
+                graph_rejected = true;
+            }
+        }
     }
 }
 
-void MessageArrivedStart(MQTT::MessageData& md) {
-    MQTT::Message &message = md.message;
-    char* str=(char*)message.payload;
+void LobbyTick() {
+    if (go_to_ready) {
+        return;
+    }
     
-    if (!host_join && !strncmp(str,"JoinReady", 9))  {
-        start_join = true;
-    } else if (host_join && !strncmp(str,"HostReady", 9)) {
-        start_host = true;
+    int next = LobbyNextOffer();
+    if (match_id == 0 && next >= 0 && (int32_t)(us_ticker_read() - lobby_joiners[next].offer_us) >= 0) {
+        // The match topics are subscribed to before the offer goes out
+        match_id = NetNewMatchId();
+        NetEnterMatch(match_id, true);
+        NetSendHostOffer(lobby_joiners[next].device, match_id);
+        offer_device = lobby_joiners[next].device;
+        offer_echoed = false;
+        num_of_lobby_joiners = 0;
+        match_sends = 0;
+        lobby_us = us_ticker_read();
     }
-}
-
-void MessageArrivedOpponent(MQTT::MessageData& md) {
-    MQTT::Message &message = md.message;
-    char* str=(char*)message.payload;
     
-    if ((!host_join && !strncmp(str,"JoinWon", 7)) || (host_join && !strncmp(str,"HostWon", 7))){
-        lost = true;
+    uint32_t now_us = us_ticker_read();
+    uint32_t elapsed_ms = (now_us - lobby_us) / 1000;
+    bool give_up = match_id != 0 && match_sends == 0 && elapsed_ms >= LOBBYOFFERMS;
+    if (match_id != 0 && match_sends != 0 && now_us - match_sent_us >= GRAPHRESENDMS * 1000) {
+        // The confirmation or its answer was lost
+        if (match_sends == GRAPHSENDS) {
+            give_up = true;
+        } else {
+            NetSendSignal((host_join) ? (NET_JOIN) : (NET_HOST));
+            match_sends++;
+            match_sent_us = now_us;
+        }
+    }
+    if (give_up) {
+        LobbyLeaveMatch();
+        elapsed_ms = LOBBYRETRYMS;
+    }
+    if (host_join && match_id == 0 && elapsed_ms >= LOBBYRETRYMS) {
+        NetSendJoinRequest();
+        lobby_us = us_ticker_read();
     }
 }
 
-void MessageArrivedReceiveNodes(MQTT::MessageData& md) {
-    join_received++;
-    MQTT::Message &message = md.message;
-    char* str=(char*)message.payload;
-    
-    if (join_received == 1) {
-        // Count number of nodes
-        int count_num_of_nodes = 0;
-        char *p = str;
-        while (*p != '\0') {
-            if (*p == ';') {
-                count_num_of_nodes++;
-            }
-            p++;
-        }
-        
-        // Find beginning of nodes
-        p = str;
-        while (*p != '\0') {
-            if (*p >= '0' && *p <= '9') {
-                break;
-            }
-            p++;
-        }
-        
-        // Fill nodes
-        for (int i = 0; i < count_num_of_nodes; i++) {
-            int x, y;
-            sscanf(p, "%d,%d;", &x, &y);
-            (nodes + i)->X = x;
-            (nodes + i)->Y = y;        
-            while (*p != ';') {
-                p++;
+bool SyncGraph() {
+    if (!host_join) {
+        // The seed of the graph goes out in one message, it is sent again until
+        // the joiner acknowledges this sequence number
+        PoolTake(NORMALLEVEL);
+        graph_seq_sent++;
+        graph_acked = false;
+        for (int sends = 0; !graph_acked; sends++) {
+            if (sends == GRAPHSENDS) {
+                multiplayer_status = "The opponent did not get the puzzle";
+                return false;
             }
-            p++;
-        }
-    } else {
-        // Count number of edges
-        int count_num_of_edges = 0;
-        char *p = str;
-        while (*p != '\0' && *p != 'e') {
-            if (*p == ';') {
-                count_num_of_edges++;
+            NetSendGraph(graph_seq_sent, puzzle_seed, puzzle_lines);
+            
+            // A rejected graph is sent again at once
+            graph_rejected = false;
+            uint32_t sent_us = us_ticker_read();
+            while (!graph_acked && !graph_rejected) {
+                int waited_ms = (us_ticker_read() - sent_us) / 1000;
+                if (waited_ms >= GRAPHRESENDMS) {
+                    break;
+                }
+                if (BackButtonWait(GRAPHRESENDMS - waited_ms)) {
+                    return false;
+                }
+                HandleNetworkEvents();
             }
-            p++;
         }
-        
-        // Find beginning of edges
-        p = str;
-        while (*p != '\0') {
-            if (*p >= '0' && *p <= '9') {
-                break;
-            }
-            p++;
+        return true;
+    }
+    
+    // Wait for the graph, a damaged one is rejected so that the host sends it again
+    uint32_t start_us = us_ticker_read();
+    while (graph_seq_loaded == 0) {
+        int waited_ms = (us_ticker_read() - start_us) / 1000;
+        if (waited_ms >= (GRAPHSENDS + 1) * GRAPHRESENDMS) {
+            multiplayer_status = "The puzzle did not arrive";
+            return false;
         }
-        
-        // Fill edges
-        for (int i = 0; i < count_num_of_edges; i++) {
-            int p1, p2;
-            sscanf(p, "%d, %d;", &p1, &p2);
-            (edges + i)->point1 = (nodes + p1);
-            (edges + i)->point2 = (nodes + p2);      
-            while (*p != ';') {
-                p++;
-            }
-            p++;
+        if (BackButtonWait((GRAPHSENDS + 1) * GRAPHRESENDMS - waited_ms)) {
+            return false;
         }
+        HandleNetworkEvents();
     }
+    return true;
 }
 
-void MessageArrivedReceiveConfirmation(MQTT::MessageData& md) {
-    MQTT::Message &message = md.message;
-    char* str=(char*)message.payload;
-    if (!strncmp(str,"Received", 8))  {
-        join_received++;
-    }   
+bool BackButtonWait(int timeout_ms) {
+    // Other touches are ignored, a message or the timeout ends the wait as well
+    TouchEvent event;
+    return TouchWait(&event, timeout_ms) && event.type != TOUCH_RELEASE &&
+           event.x >= 219 && event.x <= 239 && event.y >= 0 && event.y <= 20;
 }
 
-void GenerateGraph() {
-    int lines[4][3];
-    
-    // Set seed for randomisation
-    static int num_of_times_called = 0;
+void LobbyLeaveMatch() {
+    // Nobody confirmed the match, back to the lobby
+    NetEnterMatch(0, !host_join);
+    match_id = 0;
+    match_sends = 0;
+    offer_device = 0;
+}
 
-    CombinationsIndexArray combos(4, 3);
-    CombinationsIndexArray combosp(4, 2); 
-    do {
-        for(int i = 0; i < 4; i++){
-            for(int j = 0; j < 3; j++){
-                lines[i][j] = rand() % 10 + 1;
-                printf("%d ", lines[i][j]); // This line does nothing but without it the simulator throws an exception
-            }
+int LobbyWaitMs() {
+    // Until the next offer or the next confirmation is due, at most LOBBYRETRYMS
+    uint32_t now_us = us_ticker_read();
+    int32_t left_us = LOBBYRETRYMS * 1000;
+    int next = LobbyNextOffer();
+    if (next >= 0) {
+        left_us = min(left_us, (int32_t)(lobby_joiners[next].offer_us - now_us));
+    }
+    if (match_id != 0 && match_sends != 0) {
+        left_us = min(left_us, (int32_t)(match_sent_us + GRAPHRESENDMS * 1000 - now_us));
+    }
+    return (left_us > 0) ? ((left_us + 999) / 1000) : (0);
+}
+
+uint32_t OfferDelayUs(uint32_t device) {
+    // Hash of both device IDs, so every joiner prefers other hosts and hosts
+    // with a close delay for one joiner are far apart for the next
+    uint32_t hash = (NetDeviceId() ^ (device * 2654435761u)) * 2246822519u;
+    hash ^= hash >> 15;
+    return (hash % LOBBYJITTERMS) * 1000;
+}
+
+void LobbyJoinerSeen(uint32_t device) {
+    uint32_t now_us = us_ticker_read();
+    for (int i = 0; i < num_of_lobby_joiners; i++) {
+        if (lobby_joiners[i].device == device) {
+            lobby_joiners[i].seen_us = now_us;
+            return;
         }
-    } while ((!CheckConcurrent(lines[combos[0]],lines[combos[1]],lines[combos[2]])  &&
-           !CheckParallel(lines[combosp[0]], lines[combosp[1]]) && combosp.advance()) || combos.advance() );
+    }
+    if (num_of_lobby_joiners < LOBBYJOINERS) {
+        LobbyJoiner joiner = {device, now_us + OfferDelayUs(device), now_us};
+        lobby_joiners[num_of_lobby_joiners++] = joiner;
+    }
+}
 
-    // Calculate points of intersection
-    Point intersections[3][3];
-    for(int i = 0; i < 3; i++) {
-        for(int j = 0; j < 3; j++) {
-            if((i + j) < 3) {  
-                intersections[i][j] = LineIntersection(lines[i], lines[j + i + 1]);
-            }
+void LobbyJoinerTaken(uint32_t device) {
+    for (int i = 0; i < num_of_lobby_joiners; i++) {
+        if (lobby_joiners[i].device == device) {
+            lobby_joiners[i] = lobby_joiners[--num_of_lobby_joiners];
+            return;
         }
     }
+}
 
-    // Randomize points of intersection
-    for(int i = 0; i < 3; i++) {
-        for(int j = 0; j < 3; j++) {
-            if((i + j) < 3) {    
-                intersections[i][j].X = rand() % 230 + 5;
-                intersections[i][j].Y = rand() % 194 + 41;
-            }
+int LobbyNextOffer() {
+    // Joiners that stopped asking found a match or left the lobby
+    uint32_t now_us = us_ticker_read();
+    int next = -1;
+    for (int i = 0; i < num_of_lobby_joiners; i++) {
+        if (now_us - lobby_joiners[i].seen_us > 2 * LOBBYRETRYMS * 1000) {
+            lobby_joiners[i--] = lobby_joiners[--num_of_lobby_joiners];
+        } else if (next < 0 || (int32_t)(lobby_joiners[i].offer_us - lobby_joiners[next].offer_us) < 0) {
+            next = i;
         }
     }
-    
-    // Fill nodes array
-    int temp = 0;
-    for(int i = 0; i < 3; i++) {
-        for(int j = 0; j < 3; j++) {
-            if((i + j) < 3) {      
-                nodes[temp++] = intersections[i][j];
-            }
+    return next;
+}
+
+void ReceiveGraph(const NetEvent &event) {
+    // The host did not get the acknowledgement and sent the graph again
+    if (graph_seq_loaded != 0) {
+        if (event.seq == graph_seq_loaded) {
+            NetSendGraphAck(event.seq, 0);
         }
+        return;
     }
     
-    // Get random number of edges between 10 and 12
-    // for only 8 and 9 edges it is too easy to solve
-    num_of_edges = rand() % 3 + 10;
-    
-    // Set default 9 edges
-    edges[0].point1 = nodes + 0;
-    edges[0].point2 = nodes + 1;
+    // Status 0 acknowledges the graph, 1 asks for it again
+    if (event.type == NET_GRAPH_DAMAGED || event.lines < 2 || event.lines > LEVELLINES + 3) {
+        NetSendGraphAck(event.seq, 1);
+        return;
+    }
+    NewPuzzle(event.seed, event.lines);
+    graph_seq_loaded = event.seq;
+    NetSendGraphAck(event.seq, 0);
+}
+
+void NewPuzzle(uint32_t seed, int num_of_lines) {
+    MakePuzzle(seed, num_of_lines);
+    StartPuzzle();
+}
+
+void MakePuzzle(uint32_t seed, int num_of_lines) {
+    // A graph that is not planar can not be solved, the next seed is used
+    // then, which the opponent gets in the graph message
+    Random random;
+    while (true) {
+        RandomSeed(&random, seed, PUZZLESTREAM);
+        GenerateGraph(&random, num_of_lines);
+        if (PuzzlePlanar()) {
+            break;
+        }
+        seed++;
+    }
     
-    edges[1].point1 = nodes + 1;
-    edges[1].point2 = nodes + 2;
+    puzzle_seed = seed;
+    puzzle_lines = num_of_lines;
     
-    edges[2].point1 = nodes + 0;
-    edges[2].point2 = nodes + 4;
+    solution_found = SolvePuzzle();
+    if (!solution_found) {
+        printf("Puzzle %lu has no crossing-free layout\n", (unsigned long)seed);
+    }
+}
+
+void StartPuzzle() {
+    // Only the puzzle that is played is logged, the pool makes others in the menus
+    printf("Puzzle %lu with %d lines\n", (unsigned long)puzzle_seed, puzzle_lines);
+    InitIntersections();
+    ViewReset();
+    
+    // Crazy mode moves have their own stream, so they are the same every
+    // time the puzzle is played no matter how the graph was generated
+    RandomSeed(&crazy_random, puzzle_seed, CRAZYSTREAM);
+}
+
+bool PoolRefill() {
+    // One puzzle for the level with the fewest, false when all are full.
+    // Only called in the menus, where the current graph is not used.
+    int level = 0;
+    for (int i = 1; i < NUMOFLEVELS; i++) {
+        if (pool_count[i] < pool_count[level]) {
+            level = i;
+        }
+    }
+    if (pool_count[level] == POOLSIZE) {
+        return false;
+    }
     
-    edges[3].point1 = nodes + 4;
-    edges[3].point2 = nodes + 3; 
+    // The graph and its solution move into the pool
+    MakePuzzle(NewPuzzleSeed(), LEVELLINES + level + 1);
+    Puzzle *puzzle = puzzle_pool[level] + pool_count[level]++;
+    puzzle->seed = puzzle_seed;
+    puzzle->graph = graph;
+    puzzle->solution_x = solution_x;
+    puzzle->solution_y = solution_y;
+    puzzle->solution_found = solution_found;
+    graph.num_of_nodes = 0;
+    graph.num_of_edges = 0;
+    graph.x = graph.y = NULL;
+    graph.node1 = graph.node2 = NULL;
+    solution_x = solution_y = NULL;
+    return true;
+}
 
-    edges[4].point1 = nodes + 1;
-    edges[4].point2 = nodes + 5;
+void PoolTake(int level) {
+    // Only when the menus were left too quickly is the puzzle made now
+    if (pool_count[level - 1] == 0) {
+        NewPuzzle(NewPuzzleSeed(), LEVELLINES + level);
+        return;
+    }
     
-    edges[5].point1 = nodes + 2;
-    edges[5].point2 = nodes + 5;    
+    Puzzle *puzzle = puzzle_pool[level - 1] + --pool_count[level - 1];
+    delete[] graph.x;
+    delete[] graph.y;
+    delete[] graph.node1;
+    delete[] graph.node2;
+    delete[] solution_x;
+    delete[] solution_y;
+    graph = puzzle->graph;
+    solution_x = puzzle->solution_x;
+    solution_y = puzzle->solution_y;
+    solution_found = puzzle->solution_found;
+    puzzle_seed = puzzle->seed;
+    puzzle_lines = LEVELLINES + level;
+    StartPuzzle();
+}
+
+bool MenuTouchWait(TouchEvent *event) {
+    // The pool is refilled one puzzle at a time while nothing is touched
+    while (PoolRefill()) {
+        if (TouchWait(event, 0)) {
+            return true;
+        }
+    }
+    return TouchWait(event, TOUCHFOREVER);
+}
+
+uint32_t NewPuzzleSeed() {
+    if (PUZZLESEED != 0) {
+        return PUZZLESEED;
+    }
     
-    edges[6].point1 = nodes + 4;
-    edges[6].point2 = nodes + 5;     
+    // The time the player started the game at is mixed into a running generator
+    static Random seeds = {0, 1};
+    seeds.state += us_ticker_read();
+    RandomNext(&seeds);
+    return RandomNext(&seeds);
+}
 
-    edges[7].point1 = nodes + 3;
-    edges[7].point2 = nodes + 5;
+void GenerateGraph(Random *random, int num_of_lines) {
+    // Lines a * x + b * y = c, their directions are spread over half a turn so
+    // no two are parallel and their offsets are random so no three meet in one point
+    double (*lines)[3] = new double[num_of_lines][3];
+    for (int i = 0; i < num_of_lines; i++) {
+        double angle = M_PI * (i + RandomDouble(random)) / num_of_lines;
+        lines[i][0] = -sin(angle);
+        lines[i][1] = cos(angle);
+        lines[i][2] = 2.0 * RandomDouble(random) - 1.0;
+    }
+    
+    // Every pair of lines meets in one node and every line is split into
+    // edges by the other lines
+    AllocateNodes(&graph, num_of_lines * (num_of_lines - 1) / 2);
+    AllocateEdges(&graph, num_of_lines * (num_of_lines - 2));
+    
+    // Connect consecutive points of intersection along every line
+    LinePoint *line_points = new LinePoint[num_of_lines - 1];
+    int edge = 0;
+    for (int i = 0; i < num_of_lines; i++) {
+        int count = 0;
+        for (int j = 0; j < num_of_lines; j++) {
+            if (j == i) {
+                continue;
+            }
+            double x, y;
+            LineIntersection(lines[i], lines[j], &x, &y);
+            (line_points + count)->position = lines[i][1] * x - lines[i][0] * y;
+            (line_points + count)->node = LinesNode(min(i, j), max(i, j), num_of_lines);
+            count++;
+        }
+        
+        qsort(line_points, count, sizeof(LinePoint), CompareLinePoints);
+        for (int k = 0; k < count - 1; k++) {
+            graph.node1[edge] = (line_points + k)->node;
+            graph.node2[edge++] = (line_points + k + 1)->node;
+        }
+    }
+    delete[] line_points;
+    delete[] lines;
+    
+    // Randomize positions of nodes until some edges cross, a puzzle must not
+    // start solved. Fewer than 4 lines can never cross, so the tries are bounded.
+    ScreenRect world = PuzzleWorld(graph.num_of_nodes);
+    for (int tries = 0; tries < SCRAMBLETRIES; tries++) {
+        for (int i = 0; i < graph.num_of_nodes; i++) {
+            graph.x[i] = RandomBelow(random, world.x2 - world.x1 + 1) + world.x1;
+            graph.y[i] = RandomBelow(random, world.y2 - world.y1 + 1) + world.y1;
+        }
+        if (LayoutEdgeCrossings(graph.x, graph.y) > 0) {
+            break;
+        }
+    }
+}
 
-    edges[8].point1 = nodes + 0;
-    edges[8].point2 = nodes + 2;  
+bool PuzzlePlanar() {
+    uint16_t *witness = new uint16_t[graph.num_of_edges];
+    int length = 0;
+    bool planar = PlanarityTest(graph.num_of_nodes, graph.num_of_edges, graph.node1, graph.node2, witness, &length);
+    
+    // The witness has five branch nodes when it is a subdivision of K5 and six for K3,3
+    if (!planar) {
+        int *degree = new int[graph.num_of_nodes];
+        memset(degree, 0, graph.num_of_nodes * sizeof(int));
+        int branch_nodes = 0;
+        for (int i = 0; i < length; i++) {
+            branch_nodes += (++degree[graph.node1[witness[i]]] == 3);
+            branch_nodes += (++degree[graph.node2[witness[i]]] == 3);
+        }
+        printf("Graph is not planar, these edges make a subdivision of %s:", (branch_nodes == 5) ? ("K5") : ("K3,3"));
+        for (int i = 0; i < length; i++) {
+            printf(" %d-%d", graph.node1[witness[i]], graph.node2[witness[i]]);
+        }
+        printf("\n");
+        delete[] degree;
+    }
     
-    // Add additional edges
-    if (num_of_edges >= 10) {
-        edges[9].point1 = nodes + 0;
-        edges[9].point2 = nodes + 3;
+    delete[] witness;
+    return planar;
+}
+
+bool SolvePuzzle() {
+    delete[] solution_x;
+    delete[] solution_y;
+    solution_x = new int16_t[graph.num_of_nodes];
+    solution_y = new int16_t[graph.num_of_nodes];
+    double *x = new double[graph.num_of_nodes];
+    double *y = new double[graph.num_of_nodes];
+    
+    // Rounding to pixels can make edges touch, then another face is put outside
+    ScreenRect world = PuzzleWorld(graph.num_of_nodes);
+    bool solved = false;
+    for (int outer = 0; !solved; outer++) {
+        if (!SolveLayout(graph.num_of_nodes, graph.num_of_edges, graph.node1, graph.node2,
+                         world.x1, world.y1, world.x2, world.y2, outer, x, y)) {
+            break;
+        }
+        for (int i = 0; i < graph.num_of_nodes; i++) {
+            solution_x[i] = (int16_t)lround(x[i]);
+            solution_y[i] = (int16_t)lround(y[i]);
+        }
+        solved = LayoutCrossings(solution_x, solution_y) == 0;
     }
-    if (num_of_edges >= 11) {
-        edges[10].point1 = nodes + 4;
-        edges[10].point2 = nodes + 1;  
+    
+    delete[] x;
+    delete[] y;
+    return solved;
+}
+
+int LayoutEdgeCrossings(const int16_t *x, const int16_t *y) {
+    // Pairs of edges that cross or touch with the nodes at x and y
+    int count = 0;
+    for (int i = 0; i < graph.num_of_edges; i++) {
+        Point p1 = {x[graph.node1[i]], y[graph.node1[i]]}, q1 = {x[graph.node2[i]], y[graph.node2[i]]};
+        for (int j = i + 1; j < graph.num_of_edges; j++) {
+            if (EdgesShareNode(i, j)) {
+                continue;
+            }
+            Point p2 = {x[graph.node1[j]], y[graph.node1[j]]}, q2 = {x[graph.node2[j]], y[graph.node2[j]]};
+            if (DoIntersect(p1, q1, p2, q2)) {
+                count++;
+            }
+        }
     }
-    if (num_of_edges == 12) {
-        edges[11].point1 = nodes + 3;
-        edges[11].point2 = nodes + 2;  
+    return count;
+}
+
+int LayoutCrossings(const int16_t *x, const int16_t *y) {
+    // Crossing edges and nodes on top of each other
+    int count = LayoutEdgeCrossings(x, y);
+    for (int i = 0; i < graph.num_of_nodes; i++) {
+        for (int j = i + 1; j < graph.num_of_nodes; j++) {
+            if (x[i] == x[j] && y[i] == y[j]) {
+                count++;
+            }
+        }
     }
+    return count;
 }
 
-bool CheckConcurrent(int *a, int *b, int *c) {
-    return (c[0] * (a[1] * b[2] - b[1] * a[2]) +
-            c[1] * (a[2] * b[0] - b[2] * a[0]) +
-            c[2] * (a[0] * b[1] - b[0] * a[1]) == 0);
+int LinesNode(int i, int j, int num_of_lines) {
+    // Index of the node where lines i < j meet
+    return i * num_of_lines - i * (i + 1) / 2 + (j - i - 1);
 }
 
-bool CheckParallel(int *a, int *b) {
-    return abs((-((float)a[0] / (float)a[1])) - (-((float)b[0] / (float)b[1]))) < EPSILON;
+int CompareLinePoints(const void *a, const void *b) {
+    double d = ((const LinePoint *)a)->position - ((const LinePoint *)b)->position;
+    return (d > 0) - (d < 0);
 }
 
-Point LineIntersection(int *a, int *b) {
-    return {-(a[2] * b[1] + a[1] * b[2]) / (a[0] * b[1] - b[0] * a[1]), 
-            -(a[2] * b[0] + a[0] * b[2]) / (b[0] * a[1] - a[0] * b[1])};
+void LineIntersection(double *a, double *b, double *x, double *y) {
+    double det = a[0] * b[1] - b[0] * a[1];
+    *x = (a[2] * b[1] - b[2] * a[1]) / det;
+    *y = (a[0] * b[2] - b[0] * a[2]) / det;
 }
 
 int PlayerSelection() {
@@ -1346,10 +2932,10 @@ int PlayerSelection() {
     // Option selector
     wait(0.5);
     while (true) {
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (MenuTouchWait(&event) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 53 && x <= 185 && y >= 59 && y <= 84) {
                 current_player = 0;
@@ -1370,7 +2956,6 @@ int PlayerSelection() {
                 return 1;
             }            
         }
-        wait_us(1);
     }
 }
 
@@ -1473,16 +3058,15 @@ int Leaderboard() {
     // Wait for back button to be pressed
     wait(0.5);
     while (true) {
-        BSP_TS_GetState(&TS_State);
-        if(TS_State.touchDetected) {
-            uint16_t x = TS_State.touchX[0];
-            uint16_t y = TS_State.touchY[0];
+        TouchEvent event;
+        if (MenuTouchWait(&event) && event.type != TOUCH_RELEASE) {
+            uint16_t x = event.x;
+            uint16_t y = event.y;
             
             if (x >= 219 && x <= 239 && y >= 0 && y <= 20) {
                 break;
             }            
         }
-        wait_us(1);
     }
     
     return 1;
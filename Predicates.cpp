@@ -0,0 +1,96 @@
+#include "Predicates.h"
+
+// Differences below this bound keep a product of two of them and the
+// difference of two such products within 64 bits
+#define PREDICATESMALL 2147483647LL
+
+static int SmallOrientationSign(int64_t px, int64_t py, int64_t qx, int64_t qy, int64_t rx, int64_t ry);
+static bool InSmallRange(int32_t value);
+static bool OnSegment(int32_t px, int32_t py, int32_t qx, int32_t qy, int32_t rx, int32_t ry);
+static int Sign(int64_t value);
+static uint64_t Magnitude(int64_t value);
+
+int OrientationSign(int32_t px, int32_t py, int32_t qx, int32_t qy, int32_t rx, int32_t ry) {
+    int64_t a = (int64_t)qy - py, b = (int64_t)rx - qx;
+    int64_t c = (int64_t)qx - px, d = (int64_t)ry - qy;
+    if (Magnitude(a) <= PREDICATESMALL && Magnitude(b) <= PREDICATESMALL &&
+        Magnitude(c) <= PREDICATESMALL && Magnitude(d) <= PREDICATESMALL) {
+        return Sign(a * b - c * d);
+    }
+
+    // Products of different signs are ordered by their signs, otherwise by
+    // their magnitudes, which are below 2^64
+    int sign_ab = Sign(a) * Sign(b), sign_cd = Sign(c) * Sign(d);
+    if (sign_ab != sign_cd) {
+        return (sign_ab > sign_cd) ? (1) : (-1);
+    }
+    uint64_t ab = Magnitude(a) * Magnitude(b), cd = Magnitude(c) * Magnitude(d);
+    if (ab == cd) {
+        return 0;
+    }
+    return (ab > cd) ? (sign_ab) : (-sign_ab);
+}
+
+// Function taken from: https://www.geeksforgeeks.org/check-if-two-given-line-segments-intersect/
+bool SegmentsIntersect(int32_t p1x, int32_t p1y, int32_t q1x, int32_t q1y,
+                       int32_t p2x, int32_t p2y, int32_t q2x, int32_t q2y) {
+    // Find the four orientations needed for general and special cases, one
+    // range check covers all of them in the common case
+    int o1, o2, o3, o4;
+    if (InSmallRange(p1x) && InSmallRange(p1y) && InSmallRange(q1x) && InSmallRange(q1y) &&
+        InSmallRange(p2x) && InSmallRange(p2y) && InSmallRange(q2x) && InSmallRange(q2y)) {
+        o1 = SmallOrientationSign(p1x, p1y, q1x, q1y, p2x, p2y);
+        o2 = SmallOrientationSign(p1x, p1y, q1x, q1y, q2x, q2y);
+        o3 = SmallOrientationSign(p2x, p2y, q2x, q2y, p1x, p1y);
+        o4 = SmallOrientationSign(p2x, p2y, q2x, q2y, q1x, q1y);
+    } else {
+        o1 = OrientationSign(p1x, p1y, q1x, q1y, p2x, p2y);
+        o2 = OrientationSign(p1x, p1y, q1x, q1y, q2x, q2y);
+        o3 = OrientationSign(p2x, p2y, q2x, q2y, p1x, p1y);
+        o4 = OrientationSign(p2x, p2y, q2x, q2y, q1x, q1y);
+    }
+
+    // General case
+    if (o1 != o2 && o3 != o4) {
+        return true;
+    }
+
+    // Special cases, a colinear point lies on the other segment
+    if (o1 == 0 && OnSegment(p1x, p1y, p2x, p2y, q1x, q1y)) {
+        return true;
+    }
+    if (o2 == 0 && OnSegment(p1x, p1y, q2x, q2y, q1x, q1y)) {
+        return true;
+    }
+    if (o3 == 0 && OnSegment(p2x, p2y, p1x, p1y, q2x, q2y)) {
+        return true;
+    }
+    if (o4 == 0 && OnSegment(p2x, p2y, q1x, q1y, q2x, q2y)) {
+        return true;
+    }
+
+    return false;
+}
+
+static int SmallOrientationSign(int64_t px, int64_t py, int64_t qx, int64_t qy, int64_t rx, int64_t ry) {
+    return Sign((qy - py) * (rx - qx) - (qx - px) * (ry - qy));
+}
+
+static bool InSmallRange(int32_t value) {
+    // -2^30 <= value < 2^30, so differences of two such values are below 2^31
+    return (uint32_t)value + 0x40000000u < 0x80000000u;
+}
+
+static bool OnSegment(int32_t px, int32_t py, int32_t qx, int32_t qy, int32_t rx, int32_t ry) {
+    // q is inside the bounding box of pr
+    return qx <= ((px > rx) ? (px) : (rx)) && qx >= ((px < rx) ? (px) : (rx)) &&
+           qy <= ((py > ry) ? (py) : (ry)) && qy >= ((py < ry) ? (py) : (ry));
+}
+
+static int Sign(int64_t value) {
+    return (value > 0) - (value < 0);
+}
+
+static uint64_t Magnitude(int64_t value) {
+    return (value < 0) ? (0 - (uint64_t)value) : ((uint64_t)value);
+}
@@ -0,0 +1,20 @@
+#ifndef PREDICATES_H
+#define PREDICATES_H
+
+#include <stdint.h>
+
+// Exact orientation and segment intersection tests for 32-bit coordinates.
+// When all coordinate differences fit in 32 bits the cross product is taken
+// in 64 bits, which covers the screen and anything up to 2^30 away from it.
+// Larger differences (up to 2^32) are compared as signs and 64-bit unsigned
+// magnitudes of both products, so no input overflows.
+
+// Sign of (q.y - p.y) * (r.x - q.x) - (q.x - p.x) * (r.y - q.y), 0 when
+// p, q and r are on one line
+int OrientationSign(int32_t px, int32_t py, int32_t qx, int32_t qy, int32_t rx, int32_t ry);
+
+// Whether segments p1q1 and p2q2 have a common point, touching included
+bool SegmentsIntersect(int32_t p1x, int32_t p1y, int32_t q1x, int32_t q1y,
+                       int32_t p2x, int32_t p2y, int32_t q2x, int32_t q2y);
+
+#endif
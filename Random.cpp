@@ -0,0 +1,34 @@
+#include "Random.h"
+
+void RandomSeed(Random *random, uint64_t seed, uint64_t stream) {
+    // Seeding procedure of the reference implementation
+    random->state = 0;
+    random->increment = (stream << 1) | 1;
+    RandomNext(random);
+    random->state += seed;
+    RandomNext(random);
+}
+
+uint32_t RandomNext(Random *random) {
+    uint64_t old = random->state;
+    random->state = old * 6364136223846793005ULL + random->increment;
+    uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+    uint32_t rotation = old >> 59;
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+}
+
+uint32_t RandomBelow(Random *random, uint32_t bound) {
+    // Numbers below 2^32 % bound are dropped so that every result is equally likely
+    uint32_t threshold = (0u - bound) % bound;
+    while (true) {
+        uint32_t value = RandomNext(random);
+        if (value >= threshold) {
+            return value % bound;
+        }
+    }
+}
+
+double RandomDouble(Random *random) {
+    // Strictly between 0 and 1
+    return (RandomNext(random) + 0.5) / 4294967296.0;
+}
@@ -0,0 +1,20 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+// PCG32 generator (64-bit LCG with a permuted 32-bit output). The whole state
+// is in the struct, so seeding another one with the same seed and stream
+// gives the same numbers on every device.
+
+struct Random {
+    uint64_t state;
+    uint64_t increment;
+};
+
+void RandomSeed(Random *random, uint64_t seed, uint64_t stream);
+uint32_t RandomNext(Random *random);
+uint32_t RandomBelow(Random *random, uint32_t bound);
+double RandomDouble(Random *random);
+
+#endif
@@ -0,0 +1,805 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "Solver.h"
+
+// Conjugate gradients stop at this residual (relative to the right side)
+#define SOLVERTOLERANCE 1e-12
+#define NOEDGE -1
+
+// Side of the return edges of a conflict pair, edges are undirected edge indices
+struct Interval {
+    int low;
+    int high;
+};
+
+struct ConflictPair {
+    Interval left;
+    Interval right;
+};
+
+// Graph being solved, every undirected edge e is oriented by the DFS from
+// edge_src[e] to edge_dst[e]. Half edge 2 * e goes from node1[e] to node2[e],
+// half edge 2 * e + 1 back.
+static int num_of_nodes = 0;
+static int num_of_edges = 0;
+static const uint16_t *node1 = NULL;
+static const uint16_t *node2 = NULL;
+static int *adjacency_offsets = NULL;
+static int *adjacency = NULL;
+
+// Left-right planarity test state, indexed by node or by edge
+static int *height = NULL;
+static int *parent_edge = NULL;
+static int *edge_src = NULL;
+static int *edge_dst = NULL;
+static int *lowpt = NULL;
+static int *lowpt2 = NULL;
+static int *nesting_depth = NULL;
+static int *ref = NULL;
+static int *side = NULL;
+static int *lowpt_edge = NULL;
+static int *stack_bottom = NULL;
+static int *out_offsets = NULL;
+static int *out_edges = NULL;
+static ConflictPair *stack = NULL;
+static int stack_size = 0;
+static int num_of_roots = 0;
+
+// Face boundaries while the faces are ranked
+static const int *ranked_face_offsets = NULL;
+
+// Embedding: half edges around every node in clockwise order
+static int *first_half = NULL;
+static int *cw = NULL;
+static int *ccw = NULL;
+static int *left_ref = NULL;
+static int *right_ref = NULL;
+
+static bool IsPlanar(int nodes, int edges, const uint16_t *n1, const uint16_t *n2);
+static bool LeftRightTest(int nodes, int edges, const uint16_t *n1, const uint16_t *n2);
+static void Allocate();
+static void Free();
+static void DfsOrientation(int v);
+static bool DfsTesting(int v);
+static bool AddConstraints(int ei, int e);
+static void RemoveBackEdges(int e);
+static void DfsEmbedding(int v);
+static int Sign(int e);
+static void SortOutEdges();
+static bool Conflicting(const Interval &interval, int b);
+static int Lowest(const ConflictPair &pair);
+static int HalfEdge(int e, int from);
+static int HalfEdgeTarget(int h);
+static void AddHalfEdgeCw(int v, int h, int reference);
+static void AddHalfEdgeCcw(int v, int h, int reference);
+static void AddHalfEdgeFirst(int v, int h);
+static bool TutteLayout(const int *face_offsets, const int *faces, int num_of_faces, int outer,
+                        double x1, double y1, double x2, double y2, double *x, double *y);
+static int CompareFaces(const void *a, const void *b);
+static void ConjugateGradients(int n, const int *offsets, const int *neighbours, const double *degree,
+                               const double *b, double *p);
+
+bool SolveLayout(int nodes, int edges, const uint16_t *n1, const uint16_t *n2,
+                 double x1, double y1, double x2, double y2, int outer, double *x, double *y) {
+    // Graphs this small are laid out directly
+    if (nodes <= 2) {
+        if (outer > 0 || (nodes == 2 && edges != 1)) {
+            return false;
+        }
+        for (int i = 0; i < nodes; i++) {
+            x[i] = x1 + (x2 - x1) * (i + 1) / (nodes + 1);
+            y[i] = (y1 + y2) / 2;
+        }
+        return true;
+    }
+    if (edges > 3 * nodes - 6) {
+        return false;
+    }
+
+    // Only connected graphs have a layout with one outer face
+    if (!LeftRightTest(nodes, edges, n1, n2) || num_of_roots != 1) {
+        Free();
+        return false;
+    }
+
+    // Clockwise order of the edges around every node
+    for (int e = 0; e < num_of_edges; e++) {
+        nesting_depth[e] *= Sign(e);
+    }
+    SortOutEdges();
+    for (int v = 0; v < num_of_nodes; v++) {
+        int previous = NOEDGE;
+        for (int i = out_offsets[v]; i < out_offsets[v + 1]; i++) {
+            int h = HalfEdge(out_edges[i], v);
+            if (previous == NOEDGE) {
+                AddHalfEdgeFirst(v, h);
+            } else {
+                AddHalfEdgeCw(v, h, previous);
+            }
+            previous = h;
+        }
+    }
+    DfsEmbedding(0);
+
+    // Faces: after half edge v->w comes the half edge counterclockwise
+    // of w->v around w
+    int *face_offsets = new int[2 * num_of_edges + 1];
+    int *faces = new int[2 * num_of_edges];
+    bool *visited = new bool[2 * num_of_edges];
+    memset(visited, 0, 2 * num_of_edges * sizeof(bool));
+    int num_of_faces = 0, length = 0;
+    face_offsets[0] = 0;
+    for (int h = 0; h < 2 * num_of_edges; h++) {
+        for (int g = h; !visited[g]; g = ccw[g ^ 1]) {
+            visited[g] = true;
+            faces[length++] = HalfEdgeTarget(g ^ 1);
+        }
+        if (length > face_offsets[num_of_faces]) {
+            face_offsets[++num_of_faces] = length;
+        }
+    }
+    delete[] visited;
+
+    // Euler's formula holds for every correct embedding of a connected graph,
+    // a node twice on one face is a cut node
+    bool solved = num_of_nodes - num_of_edges + num_of_faces == 2 && outer < num_of_faces;
+    int *last_face = new int[num_of_nodes];
+    for (int v = 0; v < num_of_nodes; v++) {
+        last_face[v] = -1;
+    }
+    for (int f = 0; f < num_of_faces && solved; f++) {
+        for (int i = face_offsets[f]; i < face_offsets[f + 1]; i++) {
+            if (last_face[faces[i]] == f) {
+                solved = false;
+            }
+            last_face[faces[i]] = f;
+        }
+    }
+    delete[] last_face;
+    solved = solved && TutteLayout(face_offsets, faces, num_of_faces, outer, x1, y1, x2, y2, x, y);
+    delete[] face_offsets;
+    delete[] faces;
+    Free();
+    return solved;
+}
+
+bool PlanarityTest(int nodes, int edges, const uint16_t *n1, const uint16_t *n2,
+                   uint16_t *witness, int *witness_length) {
+    if (IsPlanar(nodes, edges, n1, n2)) {
+        return true;
+    }
+    if (witness == NULL) {
+        return false;
+    }
+
+    // Edges are dropped one by one as long as what is left is not planar,
+    // at the end every edge is needed and the rest is a Kuratowski subgraph
+    int length = edges;
+    for (int e = 0; e < edges; e++) {
+        witness[e] = e;
+    }
+    uint16_t *trial1 = new uint16_t[edges];
+    uint16_t *trial2 = new uint16_t[edges];
+    for (int i = 0; i < length;) {
+        int count = 0;
+        for (int j = 0; j < length; j++) {
+            if (j != i) {
+                trial1[count] = n1[witness[j]];
+                trial2[count++] = n2[witness[j]];
+            }
+        }
+        if (IsPlanar(nodes, count, trial1, trial2)) {
+            i++;
+        } else {
+            memmove(witness + i, witness + i + 1, (length - i - 1) * sizeof(uint16_t));
+            length--;
+        }
+    }
+    delete[] trial1;
+    delete[] trial2;
+
+    *witness_length = length;
+    return false;
+}
+
+static bool IsPlanar(int nodes, int edges, const uint16_t *n1, const uint16_t *n2) {
+    // A planar graph has at most as many edges as a triangulation
+    if (nodes >= 3 && edges > 3 * nodes - 6) {
+        return false;
+    }
+    bool planar = LeftRightTest(nodes, edges, n1, n2);
+    Free();
+    return planar;
+}
+
+static bool LeftRightTest(int nodes, int edges, const uint16_t *n1, const uint16_t *n2) {
+    // The state is allocated here and freed by the caller with Free()
+    num_of_nodes = nodes;
+    num_of_edges = edges;
+    node1 = n1;
+    node2 = n2;
+    Allocate();
+
+    // Incident edges of every node
+    for (int e = 0; e < num_of_edges; e++) {
+        adjacency_offsets[node1[e] + 1]++;
+        adjacency_offsets[node2[e] + 1]++;
+    }
+    for (int v = 0; v < num_of_nodes; v++) {
+        adjacency_offsets[v + 1] += adjacency_offsets[v];
+    }
+    int *fill = new int[num_of_nodes];
+    memcpy(fill, adjacency_offsets, num_of_nodes * sizeof(int));
+    for (int e = 0; e < num_of_edges; e++) {
+        adjacency[fill[node1[e]]++] = e;
+        adjacency[fill[node2[e]]++] = e;
+    }
+    delete[] fill;
+
+    // One DFS tree for every connected component, their roots have height 0
+    num_of_roots = 0;
+    for (int v = 0; v < num_of_nodes; v++) {
+        if (height[v] < 0) {
+            height[v] = 0;
+            num_of_roots++;
+            DfsOrientation(v);
+        }
+    }
+
+    SortOutEdges();
+    for (int v = 0; v < num_of_nodes; v++) {
+        if (height[v] == 0) {
+            stack_size = 0;
+            if (!DfsTesting(v)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool TutteLayout(const int *face_offsets, const int *faces, int num_of_faces, int outer,
+                        double x1, double y1, double x2, double y2, double *x, double *y) {
+    int *order = new int[num_of_faces];
+    for (int f = 0; f < num_of_faces; f++) {
+        order[f] = f;
+    }
+    ranked_face_offsets = face_offsets;
+    qsort(order, num_of_faces, sizeof(int), CompareFaces);
+    int outer_face = order[outer];
+    delete[] order;
+
+    // Outer face on the ellipse, free nodes are numbered after the original
+    // nodes followed by one node for every inner face
+    int *free_index = new int[num_of_nodes];
+    for (int v = 0; v < num_of_nodes; v++) {
+        free_index[v] = 0;
+    }
+    int corners = face_offsets[outer_face + 1] - face_offsets[outer_face];
+    for (int i = 0; i < corners; i++) {
+        int v = faces[face_offsets[outer_face] + i];
+        double angle = 2 * M_PI * i / corners;
+        x[v] = (x1 + x2) / 2 + (x2 - x1) / 2 * cos(angle);
+        y[v] = (y1 + y2) / 2 + (y2 - y1) / 2 * sin(angle);
+        free_index[v] = -1;
+    }
+    int n = 0;
+    for (int v = 0; v < num_of_nodes; v++) {
+        if (free_index[v] == 0) {
+            free_index[v] = n++;
+        }
+    }
+    int face_nodes = n;
+    n += num_of_faces - 1;
+    if (n == 0) {
+        delete[] free_index;
+        return true;
+    }
+
+    // Laplacian of the free nodes, the pinned neighbours go to the right side
+    int *offsets = new int[n + 1];
+    int *neighbours = new int[2 * (num_of_edges + face_offsets[num_of_faces])];
+    double *degree = new double[n];
+    double *bx = new double[n];
+    double *by = new double[n];
+    double *px = new double[n];
+    double *py = new double[n];
+    memset(offsets, 0, (n + 1) * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        degree[i] = bx[i] = by[i] = 0;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        int *fill = offsets;
+        if (pass == 1) {
+            for (int i = 0; i < n; i++) {
+                offsets[i + 1] += offsets[i];
+            }
+            fill = new int[n];
+            memcpy(fill, offsets, n * sizeof(int));
+        }
+        for (int e = 0; e < num_of_edges; e++) {
+            int a = free_index[node1[e]], b = free_index[node2[e]];
+            for (int k = 0; k < 2; k++) {
+                if (a >= 0 && pass == 0) {
+                    degree[a]++;
+                    if (b >= 0) {
+                        fill[a + 1]++;
+                    } else {
+                        bx[a] += x[(k == 0) ? (node2[e]) : (node1[e])];
+                        by[a] += y[(k == 0) ? (node2[e]) : (node1[e])];
+                    }
+                } else if (a >= 0 && b >= 0) {
+                    neighbours[fill[a]++] = b;
+                }
+                int swap = a;
+                a = b;
+                b = swap;
+            }
+        }
+        int star = face_nodes;
+        for (int f = 0; f < num_of_faces; f++) {
+            if (f == outer_face) {
+                continue;
+            }
+            for (int i = face_offsets[f]; i < face_offsets[f + 1]; i++) {
+                int v = faces[i], a = free_index[v];
+                if (pass == 0) {
+                    degree[star]++;
+                    if (a >= 0) {
+                        degree[a]++;
+                        fill[a + 1]++;
+                        fill[star + 1]++;
+                    } else {
+                        bx[star] += x[v];
+                        by[star] += y[v];
+                    }
+                } else if (a >= 0) {
+                    neighbours[fill[a]++] = star;
+                    neighbours[fill[star]++] = a;
+                }
+            }
+            star++;
+        }
+        if (pass == 1) {
+            delete[] fill;
+        }
+    }
+
+    // Both coordinates start in the middle of the outer face
+    for (int i = 0; i < n; i++) {
+        px[i] = (x1 + x2) / 2;
+        py[i] = (y1 + y2) / 2;
+    }
+    ConjugateGradients(n, offsets, neighbours, degree, bx, px);
+    ConjugateGradients(n, offsets, neighbours, degree, by, py);
+    bool solved = true;
+    for (int v = 0; v < num_of_nodes; v++) {
+        if (free_index[v] >= 0) {
+            x[v] = px[free_index[v]];
+            y[v] = py[free_index[v]];
+        }
+        if (!isfinite(x[v]) || !isfinite(y[v])) {
+            solved = false;
+        }
+    }
+
+    delete[] free_index;
+    delete[] offsets;
+    delete[] neighbours;
+    delete[] degree;
+    delete[] bx;
+    delete[] by;
+    delete[] px;
+    delete[] py;
+    return solved;
+}
+
+static void ConjugateGradients(int n, const int *offsets, const int *neighbours, const double *degree,
+                               const double *b, double *p) {
+    double *r = new double[n];
+    double *d = new double[n];
+    double *q = new double[n];
+    double rr = 0, bb = 0;
+    for (int i = 0; i < n; i++) {
+        double ap = degree[i] * p[i];
+        for (int k = offsets[i]; k < offsets[i + 1]; k++) {
+            ap -= p[neighbours[k]];
+        }
+        r[i] = d[i] = b[i] - ap;
+        rr += r[i] * r[i];
+        bb += b[i] * b[i];
+    }
+
+    for (int iteration = 0; iteration < 4 * n + 100 && rr > SOLVERTOLERANCE * bb; iteration++) {
+        double dq = 0;
+        for (int i = 0; i < n; i++) {
+            q[i] = degree[i] * d[i];
+            for (int k = offsets[i]; k < offsets[i + 1]; k++) {
+                q[i] -= d[neighbours[k]];
+            }
+            dq += d[i] * q[i];
+        }
+        double alpha = rr / dq, next_rr = 0;
+        for (int i = 0; i < n; i++) {
+            p[i] += alpha * d[i];
+            r[i] -= alpha * q[i];
+            next_rr += r[i] * r[i];
+        }
+        for (int i = 0; i < n; i++) {
+            d[i] = r[i] + next_rr / rr * d[i];
+        }
+        rr = next_rr;
+    }
+
+    delete[] r;
+    delete[] d;
+    delete[] q;
+}
+
+static int CompareFaces(const void *a, const void *b) {
+    // Larger faces first, equal faces in the order they were found
+    int f = *(const int *)a, g = *(const int *)b;
+    int length_f = ranked_face_offsets[f + 1] - ranked_face_offsets[f];
+    int length_g = ranked_face_offsets[g + 1] - ranked_face_offsets[g];
+    return (length_f != length_g) ? (length_g - length_f) : (f - g);
+}
+
+static void Allocate() {
+    adjacency_offsets = new int[num_of_nodes + 1];
+    memset(adjacency_offsets, 0, (num_of_nodes + 1) * sizeof(int));
+    adjacency = new int[2 * num_of_edges];
+    height = new int[num_of_nodes];
+    parent_edge = new int[num_of_nodes];
+    for (int v = 0; v < num_of_nodes; v++) {
+        height[v] = -1;
+        parent_edge[v] = NOEDGE;
+    }
+    edge_src = new int[num_of_edges];
+    edge_dst = new int[num_of_edges];
+    lowpt = new int[num_of_edges];
+    lowpt2 = new int[num_of_edges];
+    nesting_depth = new int[num_of_edges];
+    ref = new int[num_of_edges];
+    side = new int[num_of_edges];
+    lowpt_edge = new int[num_of_edges];
+    stack_bottom = new int[num_of_edges];
+    for (int e = 0; e < num_of_edges; e++) {
+        edge_src[e] = -1;
+        ref[e] = NOEDGE;
+        side[e] = 1;
+        lowpt_edge[e] = NOEDGE;
+    }
+    out_offsets = new int[num_of_nodes + 1];
+    out_edges = new int[num_of_edges];
+    stack = new ConflictPair[num_of_edges + 1];
+    stack_size = 0;
+    first_half = new int[num_of_nodes];
+    left_ref = new int[num_of_nodes];
+    right_ref = new int[num_of_nodes];
+    for (int v = 0; v < num_of_nodes; v++) {
+        first_half[v] = NOEDGE;
+        left_ref[v] = right_ref[v] = NOEDGE;
+    }
+    cw = new int[2 * num_of_edges];
+    ccw = new int[2 * num_of_edges];
+}
+
+static void Free() {
+    delete[] adjacency_offsets;
+    delete[] adjacency;
+    delete[] height;
+    delete[] parent_edge;
+    delete[] edge_src;
+    delete[] edge_dst;
+    delete[] lowpt;
+    delete[] lowpt2;
+    delete[] nesting_depth;
+    delete[] ref;
+    delete[] side;
+    delete[] lowpt_edge;
+    delete[] stack_bottom;
+    delete[] out_offsets;
+    delete[] out_edges;
+    delete[] stack;
+    delete[] first_half;
+    delete[] left_ref;
+    delete[] right_ref;
+    delete[] cw;
+    delete[] ccw;
+}
+
+static void DfsOrientation(int v) {
+    // Orient the edges away from the root, tree edges first seen
+    int e = parent_edge[v];
+    for (int i = adjacency_offsets[v]; i < adjacency_offsets[v + 1]; i++) {
+        int vw = adjacency[i];
+        if (edge_src[vw] >= 0) {
+            continue;
+        }
+        int w = (node1[vw] == v) ? (node2[vw]) : (node1[vw]);
+        edge_src[vw] = v;
+        edge_dst[vw] = w;
+        lowpt[vw] = height[v];
+        lowpt2[vw] = height[v];
+        if (height[w] < 0) {
+            parent_edge[w] = vw;
+            height[w] = height[v] + 1;
+            DfsOrientation(w);
+        } else {
+            lowpt[vw] = height[w];
+        }
+
+        // Edges returning lower are nested outside, chordal edges after the others
+        nesting_depth[vw] = 2 * lowpt[vw];
+        if (lowpt2[vw] < height[v]) {
+            nesting_depth[vw]++;
+        }
+
+        if (e != NOEDGE) {
+            if (lowpt[vw] < lowpt[e]) {
+                lowpt2[e] = (lowpt[e] < lowpt2[vw]) ? (lowpt[e]) : (lowpt2[vw]);
+                lowpt[e] = lowpt[vw];
+            } else if (lowpt[vw] > lowpt[e]) {
+                lowpt2[e] = (lowpt2[e] < lowpt[vw]) ? (lowpt2[e]) : (lowpt[vw]);
+            } else {
+                lowpt2[e] = (lowpt2[e] < lowpt2[vw]) ? (lowpt2[e]) : (lowpt2[vw]);
+            }
+        }
+    }
+}
+
+static bool DfsTesting(int v) {
+    int e = parent_edge[v];
+    for (int i = out_offsets[v]; i < out_offsets[v + 1]; i++) {
+        int ei = out_edges[i];
+        int w = edge_dst[ei];
+        stack_bottom[ei] = stack_size;
+        if (ei == parent_edge[w]) {
+            if (!DfsTesting(w)) {
+                return false;
+            }
+        } else {
+            lowpt_edge[ei] = ei;
+            ConflictPair pair = {{NOEDGE, NOEDGE}, {ei, ei}};
+            stack[stack_size++] = pair;
+        }
+
+        // Integrate the new return edges
+        if (lowpt[ei] < height[v]) {
+            if (i == out_offsets[v]) {
+                lowpt_edge[e] = lowpt_edge[ei];
+            } else if (!AddConstraints(ei, e)) {
+                return false;
+            }
+        }
+    }
+
+    if (e != NOEDGE) {
+        RemoveBackEdges(e);
+    }
+    return true;
+}
+
+static bool AddConstraints(int ei, int e) {
+    ConflictPair p = {{NOEDGE, NOEDGE}, {NOEDGE, NOEDGE}};
+
+    // Merge the return edges of ei into p.right
+    do {
+        ConflictPair q = stack[--stack_size];
+        if (q.left.low != NOEDGE || q.left.high != NOEDGE) {
+            Interval swap = q.left;
+            q.left = q.right;
+            q.right = swap;
+        }
+        if (q.left.low != NOEDGE || q.left.high != NOEDGE) {
+            return false;
+        }
+        if (lowpt[q.right.low] > lowpt[e]) {
+            if (p.right.low == NOEDGE && p.right.high == NOEDGE) {
+                p.right = q.right;
+            } else {
+                ref[p.right.low] = q.right.high;
+            }
+            p.right.low = q.right.low;
+        } else {
+            ref[q.right.low] = lowpt_edge[e];
+        }
+    } while (stack_size != stack_bottom[ei]);
+
+    // Merge the conflicting return edges of the earlier edges into p.left
+    while (stack_size > 0 && (Conflicting(stack[stack_size - 1].left, ei) ||
+                              Conflicting(stack[stack_size - 1].right, ei))) {
+        ConflictPair q = stack[--stack_size];
+        if (Conflicting(q.right, ei)) {
+            Interval swap = q.left;
+            q.left = q.right;
+            q.right = swap;
+        }
+        if (Conflicting(q.right, ei)) {
+            return false;
+        }
+        if (p.right.low != NOEDGE) {
+            ref[p.right.low] = q.right.high;
+        }
+        if (q.right.low != NOEDGE) {
+            p.right.low = q.right.low;
+        }
+        if (p.left.low == NOEDGE && p.left.high == NOEDGE) {
+            p.left = q.left;
+        } else {
+            ref[p.left.low] = q.left.high;
+        }
+        p.left.low = q.left.low;
+    }
+
+    if (p.left.low != NOEDGE || p.left.high != NOEDGE || p.right.low != NOEDGE || p.right.high != NOEDGE) {
+        stack[stack_size++] = p;
+    }
+    return true;
+}
+
+static void RemoveBackEdges(int e) {
+    int u = edge_src[e];
+
+    // Drop the conflict pairs whose lowest return edge ends at u
+    while (stack_size > 0 && Lowest(stack[stack_size - 1]) == height[u]) {
+        ConflictPair p = stack[--stack_size];
+        if (p.left.low != NOEDGE) {
+            side[p.left.low] = -1;
+        }
+    }
+
+    // Trim the return edges ending at u from the next one
+    if (stack_size > 0) {
+        ConflictPair p = stack[--stack_size];
+        while (p.left.high != NOEDGE && edge_dst[p.left.high] == u) {
+            p.left.high = ref[p.left.high];
+        }
+        if (p.left.high == NOEDGE && p.left.low != NOEDGE) {
+            ref[p.left.low] = p.right.low;
+            side[p.left.low] = -1;
+            p.left.low = NOEDGE;
+        }
+        while (p.right.high != NOEDGE && edge_dst[p.right.high] == u) {
+            p.right.high = ref[p.right.high];
+        }
+        if (p.right.high == NOEDGE && p.right.low != NOEDGE) {
+            ref[p.right.low] = p.left.low;
+            side[p.right.low] = -1;
+            p.right.low = NOEDGE;
+        }
+        stack[stack_size++] = p;
+    }
+
+    // e is on the side of its highest return edge
+    if (lowpt[e] < height[u] && stack_size > 0) {
+        int hl = stack[stack_size - 1].left.high;
+        int hr = stack[stack_size - 1].right.high;
+        if (hl != NOEDGE && (hr == NOEDGE || lowpt[hl] > lowpt[hr])) {
+            ref[e] = hl;
+        } else {
+            ref[e] = hr;
+        }
+    }
+}
+
+static void DfsEmbedding(int v) {
+    for (int i = out_offsets[v]; i < out_offsets[v + 1]; i++) {
+        int ei = out_edges[i];
+        int w = edge_dst[ei];
+        int back = HalfEdge(ei, w);
+        if (ei == parent_edge[w]) {
+            AddHalfEdgeFirst(w, back);
+            left_ref[v] = right_ref[v] = HalfEdge(ei, v);
+            DfsEmbedding(w);
+        } else if (side[ei] == 1) {
+            AddHalfEdgeCw(w, back, right_ref[w]);
+        } else {
+            AddHalfEdgeCcw(w, back, left_ref[w]);
+            left_ref[w] = back;
+        }
+    }
+}
+
+static int Sign(int e) {
+    // Side relative to the chain of references, which is then cut short.
+    // stack_bottom is no longer needed after the test and holds the chain.
+    int length = 0;
+    for (int f = e; ref[f] != NOEDGE; f = ref[f]) {
+        stack_bottom[length++] = f;
+    }
+    for (int i = length - 1; i >= 0; i--) {
+        int f = stack_bottom[i];
+        side[f] *= side[ref[f]];
+        ref[f] = NOEDGE;
+    }
+    return side[e];
+}
+
+static void SortOutEdges() {
+    // Counting sort by nesting depth keeps the order of equal edges
+    memset(out_offsets, 0, (num_of_nodes + 1) * sizeof(int));
+    for (int e = 0; e < num_of_edges; e++) {
+        out_offsets[edge_src[e] + 1]++;
+    }
+    for (int v = 0; v < num_of_nodes; v++) {
+        out_offsets[v + 1] += out_offsets[v];
+    }
+    int buckets = 4 * num_of_nodes + 2;
+    int *bucket_offsets = new int[buckets + 1];
+    int *order = new int[num_of_edges];
+    memset(bucket_offsets, 0, (buckets + 1) * sizeof(int));
+    for (int e = 0; e < num_of_edges; e++) {
+        bucket_offsets[nesting_depth[e] + 2 * num_of_nodes + 1]++;
+    }
+    for (int i = 0; i < buckets; i++) {
+        bucket_offsets[i + 1] += bucket_offsets[i];
+    }
+    for (int e = 0; e < num_of_edges; e++) {
+        order[bucket_offsets[nesting_depth[e] + 2 * num_of_nodes]++] = e;
+    }
+    delete[] bucket_offsets;
+    int *fill = new int[num_of_nodes];
+    memcpy(fill, out_offsets, num_of_nodes * sizeof(int));
+    for (int i = 0; i < num_of_edges; i++) {
+        out_edges[fill[edge_src[order[i]]]++] = order[i];
+    }
+    delete[] fill;
+    delete[] order;
+}
+
+static bool Conflicting(const Interval &interval, int b) {
+    return (interval.low != NOEDGE || interval.high != NOEDGE) && lowpt[interval.high] > lowpt[b];
+}
+
+static int Lowest(const ConflictPair &pair) {
+    if (pair.left.low == NOEDGE && pair.left.high == NOEDGE) {
+        return lowpt[pair.right.low];
+    }
+    if (pair.right.low == NOEDGE && pair.right.high == NOEDGE) {
+        return lowpt[pair.left.low];
+    }
+    int left = lowpt[pair.left.low], right = lowpt[pair.right.low];
+    return (left < right) ? (left) : (right);
+}
+
+static int HalfEdge(int e, int from) {
+    return (node1[e] == from) ? (2 * e) : (2 * e + 1);
+}
+
+static int HalfEdgeTarget(int h) {
+    return (h & 1) ? (node1[h >> 1]) : (node2[h >> 1]);
+}
+
+static void AddHalfEdgeCw(int v, int h, int reference) {
+    if (reference == NOEDGE) {
+        cw[h] = ccw[h] = h;
+        first_half[v] = h;
+        return;
+    }
+    int next = cw[reference];
+    cw[reference] = h;
+    ccw[h] = reference;
+    cw[h] = next;
+    ccw[next] = h;
+}
+
+static void AddHalfEdgeCcw(int v, int h, int reference) {
+    if (reference == NOEDGE) {
+        AddHalfEdgeCw(v, h, NOEDGE);
+        return;
+    }
+    AddHalfEdgeCw(v, h, ccw[reference]);
+    if (reference == first_half[v]) {
+        first_half[v] = h;
+    }
+}
+
+static void AddHalfEdgeFirst(int v, int h) {
+    if (first_half[v] == NOEDGE) {
+        AddHalfEdgeCw(v, h, NOEDGE);
+    } else {
+        AddHalfEdgeCcw(v, h, first_half[v]);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <stdint.h>
+
+// Crossing-free straight-line layouts of planar graphs. The left-right
+// planarity test (Brandes) gives the order of the edges around every node,
+// every inner face then gets an extra node joined to its corners, so the
+// graph becomes a triangulation, and one face is put on an ellipse inside
+// the rectangle x1..x2, y1..y2. All other nodes sit in the barycenter of
+// their neighbours (Tutte embedding), which is found with conjugate
+// gradients. Faces are ranked by size, outer picks the one on the ellipse
+// (0 is the largest face), so a caller can try another face when rounding
+// the layout to pixels made edges touch.
+//
+// SolveLayout() returns false when the graph is not planar, not connected,
+// has a node whose removal disconnects it or has fewer than outer + 1 faces.
+
+// PlanarityTest() is the left-right test alone and takes O(V + E) time for
+// a graph without loops and repeated edges. When the graph is not planar
+// and witness is not NULL, the indices of the edges of a Kuratowski subgraph
+// (a subdivision of K5 or K3,3) are written to witness, which needs room for
+// num_of_edges indices, and their count to witness_length. Finding them runs
+// the test once for every edge, so it is only meant for reporting.
+
+bool PlanarityTest(int num_of_nodes, int num_of_edges, const uint16_t *node1, const uint16_t *node2,
+                   uint16_t *witness, int *witness_length);
+bool SolveLayout(int num_of_nodes, int num_of_edges, const uint16_t *node1, const uint16_t *node2,
+                 double x1, double y1, double x2, double y2, int outer, double *x, double *y);
+
+#endif
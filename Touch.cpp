@@ -0,0 +1,181 @@
+#include "mbed.h"
+#include "stm32f413h_discovery_ts.h"
+#include "Touch.h"
+
+// FT6x06 interrupt line of the STM32F413H discovery board
+#define TOUCHINTPIN PC_1
+// Sampling period while the screen is touched, the controller reports at about 100 Hz
+#define TOUCHSAMPLEMS 10
+// Sampling period while nothing is touched, it only catches a missed interrupt
+#define TOUCHIDLEMS 100
+#define TOUCHQUEUESIZE 16
+// The sampler runs above the game so that a busy game loop does not delay samples
+#define TOUCHPRIORITY osPriorityAboveNormal
+#define TOUCHSTACKSIZE 2048
+
+static InterruptIn touch_interrupt(TOUCHINTPIN);
+static Thread touch_thread(TOUCHPRIORITY, TOUCHSTACKSIZE);
+
+// Wakes the sampler when the controller interrupt fires
+static Semaphore touch_signal(0);
+// Wakes TouchWait() when an event is queued or TouchWake() is called
+static Semaphore event_signal(0);
+
+// Time of the last interrupt, the press is dated with it
+static volatile bool interrupt_pending = false;
+static volatile uint32_t interrupt_time_us = 0;
+
+// Set by TouchWake(), the waiting thread returns without an event
+static volatile bool wake_pending = false;
+
+// Events waiting for TouchWait(), oldest at queue_head. Both threads change
+// it inside critical sections, the sampler also merges moves in place.
+static TouchEvent queue[TOUCHQUEUESIZE];
+static int queue_head = 0;
+static int queue_count = 0;
+
+// Last sampled state, only the sampler uses it. Moves are only queued when a
+// position or the number of fingers changes.
+static bool pressed = false;
+static TouchEvent last = {TOUCH_RELEASE, 0, 0, 0, 0, 0, 0};
+
+static void TouchTask();
+static void TouchInterrupt();
+static void Sample();
+static bool Post(uint8_t type, uint32_t time_us);
+static TouchEvent *QueueAt(int index);
+
+void TouchInit() {
+    touch_interrupt.fall(TouchInterrupt);
+    touch_thread.start(TouchTask);
+}
+
+bool TouchWait(TouchEvent *event, int timeout_ms) {
+    uint32_t start_us = us_ticker_read();
+
+    while (true) {
+        core_util_critical_section_enter();
+        bool found = queue_count > 0;
+        if (found) {
+            *event = queue[queue_head];
+            queue_head = (queue_head + 1) % TOUCHQUEUESIZE;
+            queue_count--;
+        }
+        core_util_critical_section_exit();
+        if (found) {
+            return true;
+        }
+
+        // Queued events are returned before a wake up is noticed
+        if (wake_pending) {
+            wake_pending = false;
+            return false;
+        }
+
+        uint32_t wait_ms = osWaitForever;
+        if (timeout_ms != TOUCHFOREVER) {
+            int left_ms = timeout_ms - (int)((us_ticker_read() - start_us) / 1000);
+            if (left_ms <= 0) {
+                return false;
+            }
+            wait_ms = left_ms;
+        }
+        event_signal.wait(wait_ms);
+    }
+}
+
+void TouchWake() {
+    wake_pending = true;
+    event_signal.release();
+}
+
+static void TouchTask() {
+    // Sleep until the controller signals a touch, keep sampling while it
+    // lasts whether or not the game takes the events
+    while (true) {
+        touch_signal.wait((pressed) ? (TOUCHSAMPLEMS) : (TOUCHIDLEMS));
+        Sample();
+    }
+}
+
+static void TouchInterrupt() {
+    // The controller is read over I2C, that is left to the sampler thread
+    interrupt_time_us = us_ticker_read();
+    interrupt_pending = true;
+    touch_signal.release();
+}
+
+static void Sample() {
+    TS_StateTypeDef state;
+    BSP_TS_GetState(&state);
+
+    uint32_t time_us = us_ticker_read();
+    if (interrupt_pending) {
+        time_us = interrupt_time_us;
+        interrupt_pending = false;
+    }
+
+    if (state.touchDetected) {
+        // A single finger is reported as the second one as well
+        uint8_t count = (state.touchDetected > 1) ? (2) : (1);
+        uint16_t x = state.touchX[0], y = state.touchY[0];
+        uint16_t x2 = state.touchX[count - 1], y2 = state.touchY[count - 1];
+        bool changed = count != last.count || x != last.x || y != last.y || x2 != last.x2 || y2 != last.y2;
+        last.count = count;
+        last.x = x;
+        last.y = y;
+        last.x2 = x2;
+        last.y2 = y2;
+        if (!pressed) {
+            pressed = Post(TOUCH_PRESS, time_us);
+        } else if (changed) {
+            Post(TOUCH_MOVE, time_us);
+        }
+    } else if (pressed) {
+        pressed = !Post(TOUCH_RELEASE, time_us);
+    }
+}
+
+static bool Post(uint8_t type, uint32_t time_us) {
+    bool posted = true;
+    core_util_critical_section_enter();
+
+    // A full queue makes room by merging moves, the later event keeps the
+    // newest position. Presses and releases are never dropped, they wait for
+    // the next sample when only presses and releases are queued.
+    if (queue_count == TOUCHQUEUESIZE) {
+        int index = queue_count - 1;
+        while (index >= 0 && QueueAt(index)->type != TOUCH_MOVE) {
+            index--;
+        }
+        if (type == TOUCH_MOVE && index == queue_count - 1) {
+            queue_count--;
+        } else if (index >= 0) {
+            for (; index < queue_count - 1; index++) {
+                *QueueAt(index) = *QueueAt(index + 1);
+            }
+            queue_count--;
+        } else {
+            posted = false;
+        }
+    }
+
+    // Positions are the last sampled ones, a release keeps where the fingers were
+    if (posted) {
+        TouchEvent *event = QueueAt(queue_count);
+        *event = last;
+        event->type = type;
+        event->time_us = time_us;
+        queue_count++;
+    }
+
+    core_util_critical_section_exit();
+    if (posted) {
+        event_signal.release();
+    }
+    return posted;
+}
+
+static TouchEvent *QueueAt(int index) {
+    return queue + (queue_head + index) % TOUCHQUEUESIZE;
+}
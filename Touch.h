@@ -0,0 +1,38 @@
+#ifndef TOUCH_H
+#define TOUCH_H
+
+#include <stdint.h>
+
+// Touch screen events with the time (us_ticker_read()) they were noticed at.
+// A sampler thread is woken by the controller interrupt and samples the screen
+// until the finger is lifted, whether or not the game is waiting for events.
+// When the queue fills up moves are merged, presses and releases are kept.
+// TouchWait() returns false when timeout_ms passes without an event or when
+// TouchWake() is called, which interrupts may do to hand work to the thread.
+// Up to two fingers are reported, x and y are always the first one and a
+// change in the number of fingers is a move.
+
+typedef enum {
+    TOUCH_PRESS,
+    TOUCH_MOVE,
+    TOUCH_RELEASE
+} TouchEventType;
+
+struct TouchEvent {
+    uint8_t type;
+    uint8_t count;
+    uint16_t x;
+    uint16_t y;
+    uint16_t x2;
+    uint16_t y2;
+    uint32_t time_us;
+};
+
+// Timeout for TouchWait() that never expires
+#define TOUCHFOREVER -1
+
+void TouchInit();
+bool TouchWait(TouchEvent *event, int timeout_ms);
+void TouchWake();
+
+#endif
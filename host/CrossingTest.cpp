@@ -0,0 +1,83 @@
+// Crossing count test: the sweep line and the batched brute force have to
+// find the same pairs of crossing edges. Vector builds only count with the
+// brute force and scalar builds only use the sweep above SWEEPTHRESHOLD, so
+// this runs both on the same graphs: generated puzzles and the same puzzles
+// with the nodes pushed onto a coarse lattice, which makes many edges touch,
+// overlap or share points. Planarity.cpp is linked with its main renamed:
+//
+//   g++ -std=gnu++14 -O2 -Ihost -Dmain=planarity_main -c -o planarity-test.o Planarity.cpp
+//   g++ -std=gnu++14 -O2 -Ihost -o crossing-test host/CrossingTest.cpp planarity-test.o Framebuffer.cpp ...
+//   ./crossing-test
+//
+// Build it once without and once with -msse4.1 or -mavx2 (both steps) to
+// test the scalar and the vector kernel.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Parts of Planarity.cpp used by the test
+struct Graph {
+    int num_of_nodes;
+    int num_of_edges;
+    int16_t *x;
+    int16_t *y;
+    uint16_t *node1;
+    uint16_t *node2;
+};
+
+extern Graph graph;
+extern int edge_words;
+extern uint32_t *edge_crossings;
+
+void MakePuzzle(uint32_t seed, int num_of_lines);
+void InitIntersections();
+int NumOfIntersectionsBruteForce();
+int NumOfIntersectionsSweep();
+
+// Puzzle sizes and seeds tried for each size
+#define MINLINES 4
+#define MAXLINES 16
+#define SEEDS 40
+// Lattice the nodes are pushed onto, in world units
+#define LATTICE 24
+
+static bool SameCrossings(const char *layout, uint32_t seed, int lines);
+
+int main() {
+    int graphs = 0, failures = 0;
+    for (int lines = MINLINES; lines <= MAXLINES; lines++) {
+        for (uint32_t seed = 1; seed <= SEEDS; seed++) {
+            MakePuzzle(seed * 2654435761u, lines);
+            InitIntersections();
+            failures += !SameCrossings("scrambled", seed, lines);
+
+            for (int i = 0; i < graph.num_of_nodes; i++) {
+                graph.x[i] -= graph.x[i] % LATTICE;
+                graph.y[i] -= graph.y[i] % LATTICE;
+            }
+            InitIntersections();
+            failures += !SameCrossings("lattice", seed, lines);
+            graphs += 2;
+        }
+    }
+
+    printf("%d graphs, %d with different crossings\n", graphs, failures);
+    return (failures == 0) ? (0) : (1);
+}
+
+static bool SameCrossings(const char *layout, uint32_t seed, int lines) {
+    // Both fill edge_crossings, the pairs are compared and not only the counts
+    size_t words = (size_t)graph.num_of_edges * edge_words;
+    int sweep = NumOfIntersectionsSweep();
+    std::vector<uint32_t> sweep_pairs(edge_crossings, edge_crossings + words);
+    int brute_force = NumOfIntersectionsBruteForce();
+    if (sweep == brute_force && !memcmp(sweep_pairs.data(), edge_crossings, words * sizeof(uint32_t))) {
+        return true;
+    }
+
+    printf("%s seed %lu with %d lines: sweep %d, brute force %d crossings\n", layout,
+           (unsigned long)seed, lines, sweep, brute_force);
+    return false;
+}
@@ -0,0 +1,695 @@
+#include "mbed.h"
+#include "stm32f413h_discovery_ts.h"
+#include <time.h>
+#include <ucontext.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "MQTTWire.h"
+
+// Virtual time one touch screen read takes
+#define TOUCHREADUS 1000
+#define MAXTICKERS 8
+#define MAXTHREADS 4
+// Threads get a large stack, the board sizes are too small for glibc printf
+#define THREADSTACKSIZE (256 * 1024)
+
+// Line of a touch trace: "<ms> down <x> <y>", "<ms> move <x> <y>" (both
+// take a second finger as "<x> <y> <x2> <y2>"), "<ms> up",
+// "<ms> publish <topic> <payload>" (\xNN stands for one byte),
+// "<ms> dump <file.ppm>" (relative to PLANARITY_DUMPDIR) or "<ms> quit"
+struct TraceEvent {
+    uint64_t time_us;
+    char type;
+    uint8_t count;
+    uint16_t x;
+    uint16_t y;
+    uint16_t x2;
+    uint16_t y2;
+    std::string topic;
+    std::string text;
+};
+
+struct BusMessage {
+    std::string topic;
+    std::string payload;
+};
+
+// Socket is -1 on the in-process bus, input keeps a partly received packet
+struct BusClient {
+    std::vector<std::string> topics;
+    std::deque<BusMessage> queue;
+    int socket;
+    std::string input;
+    uint16_t packet_id;
+};
+
+static uint64_t now_us = 0;
+static Ticker *tickers[MAXTICKERS];
+static int num_of_tickers = 0;
+static bool in_ticker = false;
+static bool in_interrupt = false;
+
+// Threads other than main run one at a time: a thread runs until it waits,
+// then it sleeps until its wake time comes on the virtual clock
+struct HostThread {
+    bool used;
+    bool finished;
+    void (*task)();
+    uint64_t wake_us;
+    char *stack;
+    ucontext_t context;
+};
+
+static HostThread threads[MAXTHREADS];
+static HostThread *current_thread = NULL;
+static ucontext_t main_context;
+
+static std::vector<TraceEvent> trace;
+static size_t next_event = 0;
+static bool touch_pressed = false;
+static uint8_t touch_count = 0;
+static uint16_t touch_x = 0, touch_y = 0, touch_x2 = 0, touch_y2 = 0;
+static void (*touch_interrupt)() = NULL;
+
+// Touch sample waiting for the first frame drawn after it
+static bool sample_pending = false;
+static uint64_t sample_wall_ns = 0;
+static int unanswered_samples = 0;
+static std::vector<uint64_t> latencies_ns;
+static int num_of_frames = 0;
+static uint64_t flushed_lines = 0;
+static FILE *frames_file = NULL;
+
+static std::vector<BusClient> bus_clients;
+static int trace_client = -1;
+
+// Wall-clock time of virtual time 0 with PLANARITY_REALTIME
+static bool realtime = false;
+static uint64_t realtime_start_ns = 0;
+
+static uint64_t WallTime();
+static void LoadTrace();
+static std::string DumpDirectory();
+static std::string Unescape(const char *text);
+static void ApplyEvent(const TraceEvent &event);
+static void ThreadEntry();
+static bool TopicMatches(const std::string &filter, const std::string &topic);
+static void SleepUntil(uint64_t us);
+static int BrokerConnect(const char *address, const char *client_id);
+static void BrokerSend(int client, const std::string &packet);
+static void BrokerReceive(int client);
+
+uint64_t HostTime() {
+    return now_us;
+}
+
+void HostAdvance(uint64_t us) {
+    // A thread that waits hands the clock back to main until it wakes up
+    if (current_thread != NULL) {
+        HostThread *thread = current_thread;
+        thread->wake_us = now_us + us;
+        swapcontext(&thread->context, &main_context);
+        return;
+    }
+
+    uint64_t target = now_us + us;
+
+    // Trace events, tickers and threads are handled in the order of their
+    // time, tickers do not interrupt each other
+    while (true) {
+        Ticker *due = NULL;
+        for (int i = 0; i < num_of_tickers && !in_ticker; i++) {
+            if (tickers[i]->next_us <= target && (due == NULL || tickers[i]->next_us < due->next_us)) {
+                due = tickers[i];
+            }
+        }
+        HostThread *ready = NULL;
+        for (int i = 0; i < MAXTHREADS && !in_ticker; i++) {
+            if (threads[i].used && !threads[i].finished && threads[i].wake_us <= target &&
+                (ready == NULL || threads[i].wake_us < ready->wake_us)) {
+                ready = threads + i;
+            }
+        }
+        uint64_t ticker_us = (due != NULL) ? (due->next_us) : (UINT64_MAX);
+        uint64_t thread_us = (ready != NULL) ? (ready->wake_us) : (UINT64_MAX);
+
+        if (next_event < trace.size() && trace[next_event].time_us <= target &&
+            trace[next_event].time_us <= ticker_us && trace[next_event].time_us <= thread_us) {
+            SleepUntil(trace[next_event].time_us);
+            now_us = max(now_us, trace[next_event].time_us);
+            ApplyEvent(trace[next_event++]);
+        } else if (due != NULL && ticker_us <= thread_us) {
+            SleepUntil(due->next_us);
+            now_us = due->next_us;
+            due->next_us += due->period_us;
+            in_ticker = true;
+            in_interrupt = true;
+            due->callback();
+            in_interrupt = false;
+            in_ticker = false;
+        } else if (ready != NULL) {
+            SleepUntil(ready->wake_us);
+            now_us = max(now_us, ready->wake_us);
+            current_thread = ready;
+            swapcontext(&main_context, &ready->context);
+            current_thread = NULL;
+        } else {
+            break;
+        }
+    }
+
+    SleepUntil(target);
+    now_us = target;
+}
+
+int HostThreadStart(void (*task)()) {
+    for (int i = 0; i < MAXTHREADS; i++) {
+        HostThread *thread = threads + i;
+        if (!thread->used) {
+            thread->used = true;
+            thread->finished = false;
+            thread->task = task;
+            thread->wake_us = now_us;
+            thread->stack = new char[THREADSTACKSIZE];
+            getcontext(&thread->context);
+            thread->context.uc_stack.ss_sp = thread->stack;
+            thread->context.uc_stack.ss_size = THREADSTACKSIZE;
+            thread->context.uc_link = NULL;
+            makecontext(&thread->context, ThreadEntry, 0);
+            return i;
+        }
+    }
+    fprintf(stderr, "Too many threads\n");
+    exit(1);
+}
+
+void HostThreadJoin(int thread) {
+    while (!threads[thread].finished) {
+        HostAdvance(1000);
+    }
+    delete[] threads[thread].stack;
+    threads[thread].used = false;
+}
+
+static void ThreadEntry() {
+    current_thread->task();
+
+    // Never resumed, main frees the stack in HostThreadJoin()
+    current_thread->finished = true;
+    swapcontext(&current_thread->context, &main_context);
+}
+
+void HostAttachTicker(Ticker *ticker) {
+    if (num_of_tickers < MAXTICKERS) {
+        tickers[num_of_tickers++] = ticker;
+    }
+}
+
+void HostDetachTicker(Ticker *ticker) {
+    for (int i = 0; i < num_of_tickers; i++) {
+        if (tickers[i] == ticker) {
+            tickers[i] = tickers[--num_of_tickers];
+            return;
+        }
+    }
+}
+
+uint8_t BSP_TS_Init(uint16_t ts_SizeX, uint16_t ts_SizeY) {
+    LoadTrace();
+    realtime = getenv("PLANARITY_REALTIME") != NULL;
+    realtime_start_ns = WallTime();
+
+    const char *path = getenv("PLANARITY_FRAMES");
+    if (path != NULL) {
+        frames_file = fopen(path, "w");
+        if (frames_file != NULL) {
+            fprintf(frames_file, "frame,time_ms,first_line,lines,latency_us\n");
+        }
+    }
+
+    return TS_OK;
+}
+
+uint8_t BSP_TS_GetState(TS_StateTypeDef *TS_State) {
+    HostAdvance(TOUCHREADUS);
+    HostIdle();
+
+    memset(TS_State, 0, sizeof(TS_StateTypeDef));
+    TS_State->touchDetected = (touch_pressed) ? (touch_count) : (0);
+    TS_State->touchX[0] = touch_x;
+    TS_State->touchY[0] = touch_y;
+    TS_State->touchX[1] = touch_x2;
+    TS_State->touchY[1] = touch_y2;
+    return TS_OK;
+}
+
+void HostTouchState(bool *pressed, uint16_t *x, uint16_t *y) {
+    *pressed = touch_pressed;
+    *x = touch_x;
+    *y = touch_y;
+}
+
+void HostAttachTouchInterrupt(void (*func)()) {
+    touch_interrupt = func;
+}
+
+bool HostInInterrupt() {
+    return in_interrupt;
+}
+
+void HostIdle() {
+    if (next_event == trace.size() && !touch_pressed) {
+        HostExit(0);
+    }
+}
+
+uint32_t HostDeviceUID(int word) {
+    // Lot and wafer words of a real chip, the board number is the X/Y word
+    static const uint32_t uid[3] = {0x00000000, 0x3436500D, 0x20323533};
+    if (word == 0) {
+        const char *device = getenv("PLANARITY_DEVICE");
+        return (device != NULL) ? ((uint32_t)strtoul(device, NULL, 0)) : (1);
+    }
+    return uid[word];
+}
+
+void HostPixelsChanged() {
+    // Pixels drawn by a ticker are not an answer to the touch sample
+    if (sample_pending && !in_ticker) {
+        latencies_ns.push_back(WallTime() - sample_wall_ns);
+        sample_pending = false;
+    }
+}
+
+void HostFrameFlushed(uint16_t y, uint16_t height) {
+    bool answered = sample_pending && !in_ticker;
+    HostPixelsChanged();
+
+    num_of_frames++;
+    flushed_lines += height;
+    if (frames_file != NULL) {
+        fprintf(frames_file, "%d,%.3f,%d,%d,", num_of_frames, now_us / 1000.0, y, height);
+        if (answered) {
+            fprintf(frames_file, "%.1f", latencies_ns.back() / 1000.0);
+        }
+        fprintf(frames_file, "\n");
+    }
+}
+
+void HostWritePPM(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", HostLCDWidth(), HostLCDHeight());
+    uint16_t *pixels = HostLCD();
+    for (int i = 0; i < HostLCDWidth() * HostLCDHeight(); i++) {
+        uint8_t rgb[3] = {(uint8_t)(((pixels[i] >> 11) & 0x1F) * 255 / 31),
+                          (uint8_t)(((pixels[i] >> 5) & 0x3F) * 255 / 63),
+                          (uint8_t)((pixels[i] & 0x1F) * 255 / 31)};
+        fwrite(rgb, 1, 3, file);
+    }
+    fclose(file);
+}
+
+int HostBusConnect(const char *client_id) {
+    BusClient bus_client;
+    bus_client.socket = -1;
+    bus_client.packet_id = 0;
+    const char *address = getenv("PLANARITY_BROKER");
+    if (address != NULL) {
+        bus_client.socket = BrokerConnect(address, client_id);
+        if (bus_client.socket < 0) {
+            return -1;
+        }
+    }
+    bus_clients.push_back(bus_client);
+    return bus_clients.size() - 1;
+}
+
+void HostBusDisconnect(int client) {
+    if (client >= 0 && bus_clients[client].socket >= 0) {
+        BrokerSend(client, MqttPacket(MQTT_DISCONNECT, ""));
+        close(bus_clients[client].socket);
+        bus_clients[client].socket = -1;
+    }
+}
+
+void HostBusSubscribe(int client, const char *topic) {
+    if (bus_clients[client].socket >= 0) {
+        uint16_t id = ++bus_clients[client].packet_id;
+        BrokerSend(client, MqttPacket(MQTT_SUBSCRIBE, MqttUint16(id) + MqttString(topic) + '\0'));
+        return;
+    }
+    bus_clients[client].topics.push_back(topic);
+}
+
+void HostBusUnsubscribe(int client, const char *topic) {
+    if (bus_clients[client].socket >= 0) {
+        uint16_t id = ++bus_clients[client].packet_id;
+        BrokerSend(client, MqttPacket(MQTT_UNSUBSCRIBE, MqttUint16(id) + MqttString(topic)));
+        return;
+    }
+    std::vector<std::string> &topics = bus_clients[client].topics;
+    for (size_t i = 0; i < topics.size(); i++) {
+        if (topics[i] == topic) {
+            topics.erase(topics.begin() + i);
+            return;
+        }
+    }
+}
+
+void HostBusPublish(int client, const char *topic, const void *payload, size_t length) {
+    if (getenv("PLANARITY_BROKER") != NULL) {
+        if (client < 0) {
+            // Trace messages come from a client of their own
+            if (trace_client < 0) {
+                char client_id[32];
+                sprintf(client_id, "planarity-trace-%d", (int)getpid());
+                trace_client = HostBusConnect(client_id);
+            }
+            client = trace_client;
+        }
+        if (client >= 0 && bus_clients[client].socket >= 0) {
+            BrokerSend(client, MqttPacket(MQTT_PUBLISH, MqttString(topic) + std::string((const char *)payload, length)));
+        }
+        return;
+    }
+
+    BusMessage message;
+    message.topic = topic;
+    message.payload.assign((const char *)payload, length);
+    for (size_t i = 0; i < bus_clients.size(); i++) {
+        std::vector<std::string> &topics = bus_clients[i].topics;
+        for (size_t j = 0; j < topics.size(); j++) {
+            if (TopicMatches(message.topic, topics[j])) {
+                // The client sees the topic it subscribed to
+                message.topic = topics[j];
+                bus_clients[i].queue.push_back(message);
+                message.topic = topic;
+                break;
+            }
+        }
+    }
+}
+
+bool HostBusReceive(int client, char *topic, size_t topic_size, char **payload, size_t *length) {
+    if (client >= 0 && bus_clients[client].socket >= 0) {
+        BrokerReceive(client);
+    }
+    if (client < 0 || bus_clients[client].queue.empty()) {
+        return false;
+    }
+
+    // Payload is copied with a terminating zero, the caller deletes it
+    BusMessage &message = bus_clients[client].queue.front();
+    strncpy(topic, message.topic.c_str(), topic_size - 1);
+    topic[topic_size - 1] = '\0';
+    *length = message.payload.size();
+    *payload = new char[*length + 1];
+    memcpy(*payload, message.payload.data(), *length);
+    (*payload)[*length] = '\0';
+    bus_clients[client].queue.pop_front();
+    return true;
+}
+
+void HostExit(int status) {
+    const char *path = getenv("PLANARITY_PPM");
+    if (path != NULL) {
+        HostWritePPM(path);
+    }
+    if (frames_file != NULL) {
+        fclose(frames_file);
+    }
+
+    // Touch to pixel latency of the samples that were answered with a frame
+    std::vector<uint64_t> sorted = latencies_ns;
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        mean += sorted[i];
+    }
+    fprintf(stderr, "frames: %d, lines flushed: %llu, virtual time: %.3f s\n",
+            num_of_frames, (unsigned long long)flushed_lines, now_us / 1000000.0);
+    fprintf(stderr, "touch samples answered: %d, not answered: %d\n", (int)sorted.size(), unanswered_samples);
+    if (!sorted.empty()) {
+        fprintf(stderr, "touch to pixel latency: mean %.1f us, p50 %.1f us, p95 %.1f us, max %.1f us\n",
+                mean / sorted.size() / 1000.0, sorted[sorted.size() / 2] / 1000.0,
+                sorted[sorted.size() * 95 / 100] / 1000.0, sorted.back() / 1000.0);
+    }
+
+    exit(status);
+}
+
+static uint64_t WallTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool TopicMatches(const std::string &filter, const std::string &topic) {
+    size_t f = 0, t = 0;
+    while (f < filter.size() && t < topic.size()) {
+        if (filter[f] == '+' && (f + 1 == filter.size() || filter[f + 1] == '/')) {
+            // Skip one level of the topic
+            f++;
+            while (t < topic.size() && topic[t] != '/') {
+                t++;
+            }
+        } else if (filter[f] == topic[t]) {
+            f++;
+            t++;
+        } else {
+            return false;
+        }
+    }
+    return f == filter.size() && t == topic.size();
+}
+
+static void SleepUntil(uint64_t us) {
+    if (!realtime) {
+        return;
+    }
+    uint64_t target_ns = realtime_start_ns + us * 1000;
+    uint64_t wall_ns = WallTime();
+    if (target_ns > wall_ns) {
+        struct timespec ts;
+        ts.tv_sec = (target_ns - wall_ns) / 1000000000ull;
+        ts.tv_nsec = (target_ns - wall_ns) % 1000000000ull;
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int BrokerConnect(const char *address, const char *client_id) {
+    char ip[64];
+    int port;
+    if (sscanf(address, "%63[^:]:%d", ip, &port) != 2) {
+        fprintf(stderr, "PLANARITY_BROKER should be <ip>:<port>\n");
+        exit(1);
+    }
+
+    struct sockaddr_in broker;
+    memset(&broker, 0, sizeof(broker));
+    broker.sin_family = AF_INET;
+    broker.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &broker.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&broker, sizeof(broker)) != 0) {
+        fprintf(stderr, "Cannot connect to the broker at %s\n", address);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Protocol level 4 (3.1.1), clean session, keep alive of 60 s
+    std::string body = MqttString("MQTT") + (char)4 + (char)0x02 + MqttUint16(60) + MqttString(client_id);
+    std::string packet = MqttPacket(MQTT_CONNECT, body);
+    if (send(fd, packet.data(), packet.size(), MSG_NOSIGNAL) != (ssize_t)packet.size()) {
+        close(fd);
+        return -1;
+    }
+
+    // CONNACK is the first answer, anything else is read later
+    uint8_t connack[4];
+    size_t received = 0;
+    while (received < sizeof(connack)) {
+        ssize_t n = recv(fd, connack + received, sizeof(connack) - received, 0);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        received += n;
+    }
+    if (connack[0] != MQTT_CONNACK || connack[3] != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void BrokerSend(int client, const std::string &packet) {
+    if (send(bus_clients[client].socket, packet.data(), packet.size(), MSG_NOSIGNAL) != (ssize_t)packet.size()) {
+        fprintf(stderr, "Lost the connection to the broker\n");
+    }
+}
+
+static void BrokerReceive(int client) {
+    BusClient &bus_client = bus_clients[client];
+    char buffer[1024];
+    ssize_t n;
+    while ((n = recv(bus_client.socket, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        bus_client.input.append(buffer, n);
+    }
+
+    // Only messages are handed over, acknowledgements are not waited for
+    uint8_t type;
+    std::string body;
+    while (MqttTake(&bus_client.input, &type, &body)) {
+        size_t pos = 0;
+        BusMessage message;
+        if ((type & 0xF0) == MQTT_PUBLISH && MqttReadString(body, &pos, &message.topic)) {
+            message.payload = body.substr(pos);
+            bus_client.queue.push_back(message);
+        }
+    }
+}
+
+static void LoadTrace() {
+    const char *path = getenv("PLANARITY_TRACE");
+    FILE *file = (path != NULL) ? (fopen(path, "r")) : (NULL);
+    if (file == NULL) {
+        fprintf(stderr, "Set PLANARITY_TRACE to a touch trace file\n");
+        exit(1);
+    }
+
+    char line[1024];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\0') {
+            continue;
+        }
+
+        double ms;
+        char type[16];
+        int used;
+        if (sscanf(p, "%lf %15s %n", &ms, type, &used) < 2) {
+            fprintf(stderr, "%s:%d: cannot parse line\n", path, line_number);
+            exit(1);
+        }
+        p += used;
+        p[strcspn(p, "\r\n")] = '\0';
+
+        TraceEvent event;
+        event.time_us = (uint64_t)(ms * 1000.0);
+        event.type = (!strcmp(type, "dump")) ? ('w') : (type[0]);
+        event.count = 0;
+        event.x = event.y = event.x2 = event.y2 = 0;
+        int x, y, x2, y2;
+        if (!strcmp(type, "down") || !strcmp(type, "move")) {
+            int values = sscanf(p, "%d %d %d %d", &x, &y, &x2, &y2);
+            if (values != 2 && values != 4) {
+                fprintf(stderr, "%s:%d: expected coordinates\n", path, line_number);
+                exit(1);
+            }
+            event.count = values / 2;
+            event.x = x;
+            event.y = y;
+            event.x2 = (values == 4) ? (x2) : (0);
+            event.y2 = (values == 4) ? (y2) : (0);
+        } else if (!strcmp(type, "publish")) {
+            size_t topic_length = strcspn(p, " \t");
+            event.topic.assign(p, topic_length);
+            p += topic_length;
+            event.text = Unescape(p + strspn(p, " \t"));
+        } else if (!strcmp(type, "dump")) {
+            // Relative names go to the dump directory, not where the game runs
+            event.text = p;
+            if (p[0] != '/') {
+                event.text = DumpDirectory() + "/" + event.text;
+            }
+        } else if (strcmp(type, "up") && strcmp(type, "quit")) {
+            fprintf(stderr, "%s:%d: unknown event %s\n", path, line_number, type);
+            exit(1);
+        }
+        trace.push_back(event);
+    }
+    fclose(file);
+}
+
+static std::string DumpDirectory() {
+    const char *directory = getenv("PLANARITY_DUMPDIR");
+    if (directory == NULL) {
+        directory = getenv("TMPDIR");
+    }
+    return (directory != NULL && directory[0] != '\0') ? (directory) : ("/tmp");
+}
+
+static std::string Unescape(const char *text) {
+    // Binary payloads are written with \xNN escapes
+    std::string result;
+    while (*text != '\0') {
+        unsigned int value;
+        if (text[0] == '\\' && text[1] == 'x' && sscanf(text + 2, "%2x", &value) == 1) {
+            result += (char)value;
+            text += 4;
+        } else {
+            result += *text++;
+        }
+    }
+    return result;
+}
+
+static void ApplyEvent(const TraceEvent &event) {
+    switch (event.type) {
+        case 'd':
+        case 'm':
+            if (sample_pending) {
+                unanswered_samples++;
+            }
+            touch_pressed = true;
+            touch_count = event.count;
+            touch_x = event.x;
+            touch_y = event.y;
+            touch_x2 = event.x2;
+            touch_y2 = event.y2;
+            sample_pending = true;
+            sample_wall_ns = WallTime();
+
+            // The controller pulls its interrupt line when a touch starts
+            if (event.type == 'd' && touch_interrupt != NULL) {
+                in_interrupt = true;
+                touch_interrupt();
+                in_interrupt = false;
+            }
+            break;
+        case 'u':
+            touch_pressed = false;
+            break;
+        case 'p':
+            HostBusPublish(-1, event.topic.c_str(), event.text.data(), event.text.size());
+            break;
+        case 'w':
+            HostWritePPM(event.text.c_str());
+            break;
+        case 'q':
+            HostExit(0);
+            break;
+    }
+}
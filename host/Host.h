@@ -0,0 +1,75 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Linux stand-ins for the board used by the headers in this directory:
+// virtual clock with tickers, touch screen replayed from a trace file,
+// LCD kept in memory and MQTT messages passed over an in-process bus.
+//
+// Environment variables:
+//   PLANARITY_TRACE   touch trace to replay (required)
+//   PLANARITY_PPM     LCD contents are written here as PPM on exit
+//   PLANARITY_FRAMES  one CSV line per flushed frame is written here
+//   PLANARITY_DEVICE  number of the simulated board, it changes the unique
+//                     ID of the chip (default 1)
+//   PLANARITY_BROKER  "<ip>:<port>" of an MQTT broker, MQTT goes there over
+//                     TCP instead of the in-process bus
+//   PLANARITY_REALTIME the virtual clock does not run ahead of the wall
+//                     clock, needed when other processes take part
+//   PLANARITY_DUMPDIR directory for trace dumps with relative names
+//                     (default $TMPDIR, or /tmp)
+
+class Ticker;
+
+// Virtual clock in microseconds, it only moves forward in wait(), wait_us()
+// and touch screen reads, tickers are run when their time comes
+uint64_t HostTime();
+void HostAdvance(uint64_t us);
+void HostAttachTicker(Ticker *ticker);
+void HostDetachTicker(Ticker *ticker);
+
+// Threads run one at a time, each until it waits, and sleep on the virtual
+// clock like main does. Join advances the clock until the thread returns.
+int HostThreadStart(void (*task)());
+void HostThreadJoin(int thread);
+
+// Touch screen state at the current virtual time, the interrupt handler is
+// called whenever the trace presses the screen
+void HostTouchState(bool *pressed, uint16_t *x, uint16_t *y);
+void HostAttachTouchInterrupt(void (*func)());
+
+// True while a ticker or the touch interrupt handler runs
+bool HostInInterrupt();
+
+// Called by threads that sleep, exits once the trace is over
+void HostIdle();
+
+// Word 0 to 2 of the 96 bit unique ID of the chip
+uint32_t HostDeviceUID(int word);
+
+// LCD pixels (RGB565) and notifications used for per-frame timing
+uint16_t *HostLCD();
+uint16_t HostLCDWidth();
+uint16_t HostLCDHeight();
+void HostPixelsChanged();
+void HostFrameFlushed(uint16_t y, uint16_t height);
+void HostWritePPM(const char *path);
+
+// In-process MQTT bus, a message is queued for every client subscribed to its
+// topic when it is published and handed over when the client asks for it.
+// A "+" level in a published topic matches any level of a subscription, so
+// traces can talk to a match whose ID they do not know. With PLANARITY_BROKER
+// the same calls talk to the broker, trace messages come from their own client.
+int HostBusConnect(const char *client_id);
+void HostBusDisconnect(int client);
+void HostBusSubscribe(int client, const char *topic);
+void HostBusUnsubscribe(int client, const char *topic);
+void HostBusPublish(int client, const char *topic, const void *payload, size_t length);
+bool HostBusReceive(int client, char *topic, size_t topic_size, char **payload, size_t *length);
+
+// Prints timing statistics, writes the requested files and exits
+void HostExit(int status);
+
+#endif
@@ -0,0 +1,342 @@
+#include "mbed.h"
+#include "stm32f413h_discovery_lcd.h"
+
+// ST7789H2 240x240 LCD kept in memory. Drawing follows the steps of the
+// STM32F413H-Discovery BSP, including BSP_LCD_FillRect() filling one more
+// line than its height and text never starting before column 1.
+
+#define LCDSIZE 240
+
+// Blank glyphs for the 95 printable characters, (width + 7) / 8 bytes per row
+static const uint8_t font24_table[95 * 24 * 3] = {0};
+static const uint8_t font20_table[95 * 20 * 2] = {0};
+static const uint8_t font16_table[95 * 16 * 2] = {0};
+static const uint8_t font12_table[95 * 12 * 1] = {0};
+static const uint8_t font8_table[95 * 8 * 1] = {0};
+
+sFONT Font24 = {font24_table, 17, 24};
+sFONT Font20 = {font20_table, 14, 20};
+sFONT Font16 = {font16_table, 11, 16};
+sFONT Font12 = {font12_table, 7, 12};
+sFONT Font8 = {font8_table, 5, 8};
+
+static uint16_t lcd_pixels[LCDSIZE * LCDSIZE];
+static uint16_t text_color = LCD_COLOR_BLACK;
+static uint16_t back_color = LCD_COLOR_WHITE;
+static sFONT *text_font = &Font24;
+
+static void FillTriangle(uint16_t x1, uint16_t x2, uint16_t x3, uint16_t y1, uint16_t y2, uint16_t y3);
+
+uint16_t *HostLCD() {
+    return lcd_pixels;
+}
+
+uint16_t HostLCDWidth() {
+    return LCDSIZE;
+}
+
+uint16_t HostLCDHeight() {
+    return LCDSIZE;
+}
+
+uint8_t BSP_LCD_Init(void) {
+    memset(lcd_pixels, 0, sizeof(lcd_pixels));
+    return LCD_OK;
+}
+
+uint32_t BSP_LCD_GetXSize(void) {
+    return LCDSIZE;
+}
+
+uint32_t BSP_LCD_GetYSize(void) {
+    return LCDSIZE;
+}
+
+uint16_t BSP_LCD_GetTextColor(void) {
+    return text_color;
+}
+
+uint16_t BSP_LCD_GetBackColor(void) {
+    return back_color;
+}
+
+void BSP_LCD_SetTextColor(uint16_t Color) {
+    text_color = Color;
+}
+
+void BSP_LCD_SetBackColor(uint16_t Color) {
+    back_color = Color;
+}
+
+void BSP_LCD_SetFont(sFONT *fonts) {
+    text_font = fonts;
+}
+
+sFONT *BSP_LCD_GetFont(void) {
+    return text_font;
+}
+
+void BSP_LCD_Clear(uint16_t Color) {
+    HostPixelsChanged();
+    for (int i = 0; i < LCDSIZE * LCDSIZE; i++) {
+        lcd_pixels[i] = Color;
+    }
+}
+
+void BSP_LCD_DisplayChar(uint16_t Xpos, uint16_t Ypos, uint8_t Ascii) {
+    uint16_t width = text_font->Width, height = text_font->Height;
+    uint16_t row_bytes = (width + 7) / 8;
+    uint8_t offset = 8 * row_bytes - width;
+    const uint8_t *glyph = text_font->table + (Ascii - ' ') * height * row_bytes;
+
+    for (int i = 0; i < height; i++) {
+        const uint8_t *row = glyph + row_bytes * i;
+        uint32_t line;
+        if (row_bytes == 1) {
+            line = row[0];
+        } else if (row_bytes == 2) {
+            line = (row[0] << 8) | row[1];
+        } else {
+            line = (row[0] << 16) | (row[1] << 8) | row[2];
+        }
+
+        for (int j = 0; j < width; j++) {
+            BSP_LCD_DrawPixel(Xpos + j, Ypos + i, (line & (1 << (width - j + offset - 1))) ? (text_color) : (back_color));
+        }
+    }
+}
+
+void BSP_LCD_DisplayStringAt(uint16_t Xpos, uint16_t Ypos, uint8_t *Text, Line_ModeTypdef Mode) {
+    uint16_t refcolumn;
+    uint32_t size = strlen((const char *)Text);
+    uint32_t xsize = LCDSIZE / text_font->Width;
+
+    if (Mode == CENTER_MODE) {
+        refcolumn = Xpos + ((xsize - size) * text_font->Width) / 2;
+    } else if (Mode == RIGHT_MODE) {
+        refcolumn = -Xpos + ((xsize - size) * text_font->Width);
+    } else {
+        refcolumn = Xpos;
+    }
+    if (refcolumn < 1 || refcolumn >= 0x8000) {
+        refcolumn = 1;
+    }
+
+    for (int i = 0; *Text != 0 && ((LCDSIZE - i * text_font->Width) & 0xFFFF) >= text_font->Width; i++) {
+        BSP_LCD_DisplayChar(refcolumn, Ypos, *Text++);
+        refcolumn += text_font->Width;
+    }
+}
+
+uint16_t BSP_LCD_ReadPixel(uint16_t Xpos, uint16_t Ypos) {
+    return (Xpos < LCDSIZE && Ypos < LCDSIZE) ? (lcd_pixels[Ypos * LCDSIZE + Xpos]) : (0);
+}
+
+void BSP_LCD_DrawPixel(uint16_t Xpos, uint16_t Ypos, uint16_t RGB_Code) {
+    HostPixelsChanged();
+    if (Xpos < LCDSIZE && Ypos < LCDSIZE) {
+        lcd_pixels[Ypos * LCDSIZE + Xpos] = RGB_Code;
+    }
+}
+
+void BSP_LCD_DrawHLine(uint16_t Xpos, uint16_t Ypos, uint16_t Length) {
+    for (int i = 0; i < Length; i++) {
+        BSP_LCD_DrawPixel(Xpos + i, Ypos, text_color);
+    }
+}
+
+void BSP_LCD_DrawVLine(uint16_t Xpos, uint16_t Ypos, uint16_t Length) {
+    for (int i = 0; i < Length; i++) {
+        BSP_LCD_DrawPixel(Xpos, Ypos + i, text_color);
+    }
+}
+
+void BSP_LCD_DrawLine(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2) {
+    int16_t deltax = abs(x2 - x1), deltay = abs(y2 - y1);
+    int16_t x = x1, y = y1;
+    int16_t xinc1, xinc2, yinc1, yinc2, den, num, numadd, numpixels;
+
+    xinc1 = xinc2 = (x2 >= x1) ? (1) : (-1);
+    yinc1 = yinc2 = (y2 >= y1) ? (1) : (-1);
+
+    if (deltax >= deltay) {
+        xinc1 = 0;
+        yinc2 = 0;
+        den = deltax;
+        num = deltax / 2;
+        numadd = deltay;
+        numpixels = deltax;
+    } else {
+        xinc2 = 0;
+        yinc1 = 0;
+        den = deltay;
+        num = deltay / 2;
+        numadd = deltax;
+        numpixels = deltay;
+    }
+
+    for (int i = 0; i <= numpixels; i++) {
+        BSP_LCD_DrawPixel(x, y, text_color);
+        num += numadd;
+        if (num >= den) {
+            num -= den;
+            x += xinc1;
+            y += yinc1;
+        }
+        x += xinc2;
+        y += yinc2;
+    }
+}
+
+void BSP_LCD_DrawRect(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height) {
+    BSP_LCD_DrawHLine(Xpos, Ypos, Width);
+    BSP_LCD_DrawHLine(Xpos, Ypos + Height, Width);
+    BSP_LCD_DrawVLine(Xpos, Ypos, Height);
+    BSP_LCD_DrawVLine(Xpos + Width, Ypos, Height);
+}
+
+void BSP_LCD_DrawCircle(uint16_t Xpos, uint16_t Ypos, uint16_t Radius) {
+    int32_t decision = 3 - (Radius << 1);
+    int16_t current_x = 0, current_y = Radius;
+
+    while (current_x <= current_y) {
+        BSP_LCD_DrawPixel(Xpos + current_x, Ypos - current_y, text_color);
+        BSP_LCD_DrawPixel(Xpos - current_x, Ypos - current_y, text_color);
+        BSP_LCD_DrawPixel(Xpos + current_y, Ypos - current_x, text_color);
+        BSP_LCD_DrawPixel(Xpos - current_y, Ypos - current_x, text_color);
+        BSP_LCD_DrawPixel(Xpos + current_x, Ypos + current_y, text_color);
+        BSP_LCD_DrawPixel(Xpos - current_x, Ypos + current_y, text_color);
+        BSP_LCD_DrawPixel(Xpos + current_y, Ypos + current_x, text_color);
+        BSP_LCD_DrawPixel(Xpos - current_y, Ypos + current_x, text_color);
+
+        if (decision < 0) {
+            decision += (current_x << 2) + 6;
+        } else {
+            decision += ((current_x - current_y) << 2) + 10;
+            current_y--;
+        }
+        current_x++;
+    }
+}
+
+void BSP_LCD_DrawPolygon(pPoint Points, uint16_t PointCount) {
+    if (PointCount < 2) {
+        return;
+    }
+
+    BSP_LCD_DrawLine(Points[0].X, Points[0].Y, Points[PointCount - 1].X, Points[PointCount - 1].Y);
+    for (int i = 0; i < PointCount - 1; i++) {
+        BSP_LCD_DrawLine(Points[i].X, Points[i].Y, Points[i + 1].X, Points[i + 1].Y);
+    }
+}
+
+void BSP_LCD_DrawRGBImage(uint16_t Xpos, uint16_t Ypos, uint16_t Xsize, uint16_t Ysize, uint8_t *pdata) {
+    // Pixels are RGB565 values, row after row
+    const uint16_t *rgb565 = (const uint16_t *)pdata;
+    for (int i = 0; i < Ysize; i++) {
+        for (int j = 0; j < Xsize; j++) {
+            if (Xpos + j < LCDSIZE && Ypos + i < LCDSIZE) {
+                lcd_pixels[(Ypos + i) * LCDSIZE + Xpos + j] = rgb565[i * Xsize + j];
+            }
+        }
+    }
+    HostFrameFlushed(Ypos, Ysize);
+}
+
+void BSP_LCD_FillRect(uint16_t Xpos, uint16_t Ypos, uint16_t Width, uint16_t Height) {
+    do {
+        BSP_LCD_DrawHLine(Xpos, Ypos++, Width);
+    } while (Height--);
+}
+
+void BSP_LCD_FillCircle(uint16_t Xpos, uint16_t Ypos, uint16_t Radius) {
+    int32_t decision = 3 - (Radius << 1);
+    int16_t current_x = 0, current_y = Radius;
+
+    while (current_x <= current_y) {
+        if (current_y > 0) {
+            BSP_LCD_DrawHLine(Xpos - current_y, Ypos + current_x, 2 * current_y);
+            BSP_LCD_DrawHLine(Xpos - current_y, Ypos - current_x, 2 * current_y);
+        }
+        if (current_x > 0) {
+            BSP_LCD_DrawHLine(Xpos - current_x, Ypos - current_y, 2 * current_x);
+            BSP_LCD_DrawHLine(Xpos - current_x, Ypos + current_y, 2 * current_x);
+        }
+
+        if (decision < 0) {
+            decision += (current_x << 2) + 6;
+        } else {
+            decision += ((current_x - current_y) << 2) + 10;
+            current_y--;
+        }
+        current_x++;
+    }
+
+    BSP_LCD_DrawCircle(Xpos, Ypos, Radius);
+}
+
+void BSP_LCD_FillPolygon(pPoint Points, uint16_t PointCount) {
+    if (PointCount < 2) {
+        return;
+    }
+
+    // Polygon is filled with triangles from the centre of its bounding box
+    int16_t left = Points[0].X, right = Points[0].X, top = Points[0].Y, bottom = Points[0].Y;
+    for (int i = 1; i < PointCount; i++) {
+        left = min(left, Points[i].X);
+        right = max(right, Points[i].X);
+        top = min(top, Points[i].Y);
+        bottom = max(bottom, Points[i].Y);
+    }
+    int16_t x_center = (left + right) / 2, y_center = (bottom + top) / 2;
+
+    int16_t x2 = 0, y2 = 0;
+    for (int i = 0; i < PointCount - 1; i++) {
+        int16_t x = Points[i].X, y = Points[i].Y;
+        x2 = Points[i + 1].X;
+        y2 = Points[i + 1].Y;
+        FillTriangle(x, x2, x_center, y, y2, y_center);
+        FillTriangle(x, x_center, x2, y, y_center, y2);
+        FillTriangle(x_center, x2, x, y_center, y2, y);
+    }
+    FillTriangle(Points[0].X, x2, x_center, Points[0].Y, y2, y_center);
+    FillTriangle(Points[0].X, x_center, x2, Points[0].Y, y_center, y2);
+    FillTriangle(x_center, x2, Points[0].X, y_center, y2, Points[0].Y);
+}
+
+static void FillTriangle(uint16_t x1, uint16_t x2, uint16_t x3, uint16_t y1, uint16_t y2, uint16_t y3) {
+    int16_t deltax = abs(x2 - x1), deltay = abs(y2 - y1);
+    int16_t x = x1, y = y1;
+    int16_t xinc1, xinc2, yinc1, yinc2, den, num, numadd, numpixels;
+
+    xinc1 = xinc2 = (x2 >= x1) ? (1) : (-1);
+    yinc1 = yinc2 = (y2 >= y1) ? (1) : (-1);
+
+    if (deltax >= deltay) {
+        xinc1 = 0;
+        yinc2 = 0;
+        den = deltax;
+        num = deltax / 2;
+        numadd = deltay;
+        numpixels = deltax;
+    } else {
+        xinc2 = 0;
+        yinc1 = 0;
+        den = deltay;
+        num = deltay / 2;
+        numadd = deltax;
+        numpixels = deltay;
+    }
+
+    for (int i = 0; i <= numpixels; i++) {
+        BSP_LCD_DrawLine(x, y, x3, y3);
+        num += numadd;
+        if (num >= den) {
+            num -= den;
+            x += xinc1;
+            y += yinc1;
+        }
+        x += xinc2;
+        y += yinc2;
+    }
+}
@@ -0,0 +1,399 @@
+// Multiplayer load test: a minimal MQTT broker on localhost and N pairs of
+// game processes (host build) that play whole matches against each other
+// through it, from the lobby to "HostWon". Every process replays a trace in
+// real time, the hosts solve the puzzle with one drag, so the game has to be
+// built with the seed the drag was found for, and with PROFILE for the
+// "Match ..." lines the results come from:
+//
+//   g++ -std=gnu++14 -O2 -Ihost -DPUZZLESEED=27 -DPROFILE=1 -o planarity-load-game Planarity.cpp ...
+//   g++ -std=gnu++14 -O2 -Ihost -o planarity-load host/LoadTest.cpp
+//   ./planarity-load ./planarity-load-game <pairs> [<seconds>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "MQTTWire.h"
+
+// Drag that solves puzzle 27 with 5 lines: node 3 from (90,221) to (200,200)
+#define SOLVEFROMX 90
+#define SOLVEFROMY 221
+#define SOLVETOX 200
+#define SOLVETOY 200
+#define SOLVESTEPS 10
+
+// Touches of the traces: main screen "Multiplayer", "Host", "Join" and "START"
+#define MULTIPLAYERX 120
+#define MULTIPLAYERY 100
+#define HOSTY 70
+#define JOINY 100
+#define STARTX 120
+#define STARTY 105
+
+// START is pressed this often until the match starts, hosts try the solving
+// drag this often
+#define STARTPERIODMS 500
+#define SOLVEPERIODMS 1000
+
+#define POLLMS 10
+#define LOBBYTOPIC "planarity/lobby"
+
+struct BrokerClient {
+    int socket;
+    bool connected;
+    std::string client_id;
+    std::string input;
+    std::vector<std::string> filters;
+};
+
+// Broker counters
+static std::vector<BrokerClient> clients;
+static int num_of_connects = 0;
+static int num_of_kicked = 0;
+static int lobby_published = 0;
+static int match_published = 0;
+static int num_of_delivered = 0;
+static std::map<std::string, int> won_matches;
+
+static bool TopicMatches(const std::string &filter, const std::string &topic);
+static void WriteTrace(const char *path, bool host, int seconds);
+static void Touch(FILE *file, int ms, int x, int y);
+static void HandlePacket(size_t client, uint8_t type, const std::string &body);
+static void Send(size_t client, const std::string &packet);
+static void Drop(size_t client);
+static void PrintPercentiles(const char *name, std::vector<int> values);
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <game> <pairs> [<seconds>]\n", argv[0]);
+        return 1;
+    }
+    const char *game = argv[1];
+    int pairs = atoi(argv[2]);
+    int seconds = (argc > 3) ? (atoi(argv[3])) : (15 + 3 * pairs);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Broker on a free port of the loopback interface
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_length = sizeof(address);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 128) != 0 ||
+        getsockname(listener, (struct sockaddr *)&address, &address_length) != 0) {
+        perror("broker");
+        return 1;
+    }
+    char broker[32];
+    sprintf(broker, "127.0.0.1:%d", ntohs(address.sin_port));
+
+    char directory[] = "/tmp/planarity-load-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string host_trace = std::string(directory) + "/host.txt";
+    std::string join_trace = std::string(directory) + "/join.txt";
+    WriteTrace(host_trace.c_str(), true, seconds);
+    WriteTrace(join_trace.c_str(), false, seconds);
+
+    // Devices 1 to pairs host, the others join
+    printf("%d pairs for %d s, broker %s, logs in %s\n", pairs, seconds, broker, directory);
+    fflush(stdout);
+    int running = 0;
+    for (int device = 1; device <= 2 * pairs; device++) {
+        char log[128], number[16];
+        sprintf(log, "%s/device-%d.log", directory, device);
+        sprintf(number, "%d", device);
+        pid_t pid = fork();
+        if (pid == 0) {
+            int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(fd, 1);
+            dup2(fd, 2);
+            close(listener);
+            setenv("PLANARITY_TRACE", (device <= pairs) ? (host_trace.c_str()) : (join_trace.c_str()), 1);
+            setenv("PLANARITY_BROKER", broker, 1);
+            setenv("PLANARITY_REALTIME", "1", 1);
+            setenv("PLANARITY_DEVICE", number, 1);
+            execl(game, game, (char *)NULL);
+            perror(game);
+            _exit(1);
+        }
+        if (pid > 0) {
+            running++;
+        }
+    }
+
+    // Broker loop until every game has exited
+    while (running > 0) {
+        std::vector<struct pollfd> fds(1);
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < clients.size(); i++) {
+            struct pollfd fd = {clients[i].socket, POLLIN, 0};
+            fds.push_back(fd);
+        }
+        poll(&fds[0], fds.size(), POLLMS);
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                BrokerClient client;
+                client.socket = fd;
+                client.connected = false;
+                clients.push_back(client);
+            }
+        }
+
+        // Dropped clients are removed after the pass, fds[] follows clients[]
+        for (size_t i = 0; i + 1 < fds.size() && i < clients.size(); i++) {
+            if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) || clients[i].socket < 0) {
+                continue;
+            }
+            char buffer[4096];
+            ssize_t n = recv(clients[i].socket, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                Drop(i);
+                continue;
+            }
+            clients[i].input.append(buffer, n);
+            uint8_t type;
+            std::string body;
+            while (clients[i].socket >= 0 && MqttTake(&clients[i].input, &type, &body)) {
+                HandlePacket(i, type, body);
+            }
+        }
+        for (size_t i = 0; i < clients.size();) {
+            if (clients[i].socket < 0) {
+                clients.erase(clients.begin() + i);
+            } else {
+                i++;
+            }
+        }
+
+        while (waitpid(-1, NULL, WNOHANG) > 0) {
+            running--;
+        }
+    }
+
+    // Both players print "Match <id>: lobby <ms> ms, graph sync <ms> ms"
+    std::vector<int> lobby_ms, sync_ms;
+    int hosts_ready = 0, joiners_ready = 0;
+    for (int device = 1; device <= 2 * pairs; device++) {
+        char log[128], line[256];
+        sprintf(log, "%s/device-%d.log", directory, device);
+        FILE *file = fopen(log, "r");
+        if (file == NULL) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), file) != NULL) {
+            unsigned long match, lobby, sync;
+            if (sscanf(line, "Match %lx: lobby %lu ms, graph sync %lu ms", &match, &lobby, &sync) == 3) {
+                if (device <= pairs) {
+                    hosts_ready++;
+                    sync_ms.push_back(sync);
+                } else {
+                    joiners_ready++;
+                    lobby_ms.push_back(lobby);
+                }
+            }
+        }
+        fclose(file);
+    }
+
+    printf("matches started: %d of %d (host side), %d (join side), won: %d\n", hosts_ready, pairs, joiners_ready,
+           (int)won_matches.size());
+    PrintPercentiles("lobby (join request to confirmed match)", lobby_ms);
+    PrintPercentiles("graph sync (both ready to acknowledged)", sync_ms);
+    printf("messages published: %d lobby, %d match, delivered: %d\n", lobby_published, match_published,
+           num_of_delivered);
+    printf("connections: %d, kicked for a duplicate client ID: %d\n", num_of_connects, num_of_kicked);
+    return (hosts_ready == pairs && (int)won_matches.size() == pairs) ? (0) : (1);
+}
+
+static bool TopicMatches(const std::string &filter, const std::string &topic) {
+    // "+" matches one level, "#" at the end any number of them
+    size_t f = 0, t = 0;
+    while (f < filter.size()) {
+        if (filter[f] == '#') {
+            return true;
+        }
+        if (filter[f] == '+') {
+            f++;
+            while (t < topic.size() && topic[t] != '/') {
+                t++;
+            }
+        } else if (t < topic.size() && filter[f] == topic[t]) {
+            f++;
+            t++;
+        } else {
+            return false;
+        }
+    }
+    return t == topic.size();
+}
+
+static void WriteTrace(const char *path, bool host, int seconds) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    Touch(file, 500, MULTIPLAYERX, MULTIPLAYERY);
+    Touch(file, 1500, MULTIPLAYERX, (host) ? (HOSTY) : (JOINY));
+    for (int ms = 2500; ms < seconds * 1000; ms += STARTPERIODMS) {
+        Touch(file, ms, STARTX, STARTY);
+
+        // The drag misses every node until the match has started and after it is solved
+        if (host && ms % SOLVEPERIODMS == 0) {
+            int start = ms + STARTPERIODMS / 4;
+            fprintf(file, "%d down %d %d\n", start, SOLVEFROMX, SOLVEFROMY);
+            for (int step = 1; step <= SOLVESTEPS; step++) {
+                fprintf(file, "%d move %d %d\n", start + 16 * step,
+                        SOLVEFROMX + (SOLVETOX - SOLVEFROMX) * step / SOLVESTEPS,
+                        SOLVEFROMY + (SOLVETOY - SOLVEFROMY) * step / SOLVESTEPS);
+            }
+            fprintf(file, "%d up\n", start + 16 * (SOLVESTEPS + 1));
+        }
+    }
+    fprintf(file, "%d quit\n", seconds * 1000);
+    fclose(file);
+}
+
+static void Touch(FILE *file, int ms, int x, int y) {
+    fprintf(file, "%d down %d %d\n%d up\n", ms, x, y, ms + 60);
+}
+
+static void HandlePacket(size_t client, uint8_t type, const std::string &body) {
+    BrokerClient &sender = clients[client];
+    size_t pos = 0;
+    std::string text;
+
+    switch (type & 0xF0) {
+        case MQTT_CONNECT & 0xF0: {
+            // Protocol name, level, flags and keep alive come before the client ID
+            std::string protocol;
+            if (!MqttReadString(body, &pos, &protocol)) {
+                Drop(client);
+                return;
+            }
+            pos += 4;
+            if (!MqttReadString(body, &pos, &text)) {
+                Drop(client);
+                return;
+            }
+
+            // Like a real broker the older session with the same client ID is closed
+            for (size_t i = 0; i < clients.size(); i++) {
+                if (i != client && clients[i].socket >= 0 && clients[i].connected && clients[i].client_id == text) {
+                    Drop(i);
+                    num_of_kicked++;
+                }
+            }
+            sender.client_id = text;
+            sender.connected = true;
+            num_of_connects++;
+            Send(client, MqttPacket(MQTT_CONNACK, std::string("\0\0", 2)));
+            break;
+        }
+        case MQTT_SUBSCRIBE & 0xF0: {
+            std::string granted;
+            pos = 2;
+            while (MqttReadString(body, &pos, &text) && pos < body.size()) {
+                pos++;
+                sender.filters.push_back(text);
+                granted += '\0';
+            }
+            Send(client, MqttPacket(MQTT_SUBACK, body.substr(0, 2) + granted));
+            break;
+        }
+        case MQTT_UNSUBSCRIBE & 0xF0: {
+            pos = 2;
+            while (MqttReadString(body, &pos, &text)) {
+                std::vector<std::string> &filters = sender.filters;
+                filters.erase(std::remove(filters.begin(), filters.end(), text), filters.end());
+            }
+            Send(client, MqttPacket(MQTT_UNSUBACK, body.substr(0, 2)));
+            break;
+        }
+        case MQTT_PUBLISH: {
+            // Only QoS 0 is used, so there is no packet identifier
+            if (!MqttReadString(body, &pos, &text)) {
+                Drop(client);
+                return;
+            }
+            std::string payload = body.substr(pos);
+            if (text == LOBBYTOPIC) {
+                lobby_published++;
+            } else {
+                match_published++;
+            }
+            if (payload == "HostWon" || payload == "JoinWon") {
+                won_matches[text]++;
+            }
+
+            std::string packet = MqttPacket(MQTT_PUBLISH, body);
+            for (size_t i = 0; i < clients.size(); i++) {
+                if (clients[i].socket < 0) {
+                    continue;
+                }
+                for (size_t j = 0; j < clients[i].filters.size(); j++) {
+                    if (TopicMatches(clients[i].filters[j], text)) {
+                        Send(i, packet);
+                        num_of_delivered++;
+                        break;
+                    }
+                }
+            }
+            break;
+        }
+        case MQTT_PINGREQ:
+            Send(client, MqttPacket(MQTT_PINGRESP, ""));
+            break;
+        case MQTT_DISCONNECT:
+            Drop(client);
+            break;
+    }
+}
+
+static void Send(size_t client, const std::string &packet) {
+    if (send(clients[client].socket, packet.data(), packet.size(), MSG_NOSIGNAL) != (ssize_t)packet.size()) {
+        Drop(client);
+    }
+}
+
+static void Drop(size_t client) {
+    if (clients[client].socket >= 0) {
+        close(clients[client].socket);
+        clients[client].socket = -1;
+    }
+}
+
+static void PrintPercentiles(const char *name, std::vector<int> values) {
+    if (values.empty()) {
+        printf("%s: no samples\n", name);
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    printf("%s: p50 %d ms, p90 %d ms, p99 %d ms, max %d ms\n", name, values[values.size() / 2],
+           values[values.size() * 90 / 100], values[values.size() * 99 / 100], values.back());
+}
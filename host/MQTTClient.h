@@ -0,0 +1,163 @@
+#ifndef MQTTCLIENT_H
+#define MQTTCLIENT_H
+
+// Paho MQTT client interface used by the game, backed by the in-process bus in Host.cpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include "Host.h"
+
+typedef struct {
+    const char *cstring;
+} MQTTString;
+
+typedef struct {
+    int MQTTVersion;
+    MQTTString clientID;
+    unsigned short keepAliveInterval;
+    unsigned char cleansession;
+    MQTTString username;
+    MQTTString password;
+} MQTTPacket_connectData;
+
+#define MQTTPacket_connectData_initializer {3, {NULL}, 60, 1, {NULL}, {NULL}}
+
+namespace MQTT {
+
+enum QoS {
+    QOS0,
+    QOS1,
+    QOS2
+};
+
+enum returnCode {
+    BUFFER_OVERFLOW = -2,
+    FAILURE = -1,
+    SUCCESS = 0
+};
+
+struct Message {
+    enum QoS qos;
+    bool retained;
+    bool dup;
+    unsigned short id;
+    void *payload;
+    size_t payloadlen;
+};
+
+struct MessageData {
+    MessageData(MQTTString &aTopicName, Message &aMessage) : message(aMessage), topicName(aTopicName) {}
+
+    Message &message;
+    MQTTString &topicName;
+};
+
+template <class Network, class Timer, int MAX_MQTT_PACKET_SIZE = 100, int MAX_MESSAGE_HANDLERS = 5>
+class Client {
+public:
+    typedef void (*messageHandler)(MessageData &);
+
+    Client(Network &network, unsigned int command_timeout_ms = 30000) : id(-1), num_of_handlers(0) {}
+
+    int connect(MQTTPacket_connectData &options) {
+        id = HostBusConnect(options.clientID.cstring);
+        return (id >= 0) ? (SUCCESS) : (FAILURE);
+    }
+
+    int connect() {
+        id = HostBusConnect("");
+        return (id >= 0) ? (SUCCESS) : (FAILURE);
+    }
+
+    int publish(const char *topicName, Message &message) {
+        HostBusPublish(id, topicName, message.payload, message.payloadlen);
+        return SUCCESS;
+    }
+
+    int subscribe(const char *topicFilter, enum QoS qos, messageHandler handler) {
+        // Replace the handler of a topic already subscribed to
+        int i = 0;
+        while (i < num_of_handlers && strcmp(topics[i], topicFilter) != 0) {
+            i++;
+        }
+        if (i == num_of_handlers) {
+            if (num_of_handlers == MAX_MESSAGE_HANDLERS) {
+                return FAILURE;
+            }
+            strncpy(topics[i], topicFilter, sizeof(topics[i]) - 1);
+            topics[i][sizeof(topics[i]) - 1] = '\0';
+            num_of_handlers++;
+            HostBusSubscribe(id, topicFilter);
+        }
+        handlers[i] = handler;
+
+        // Waiting for the acknowledgement hands over queued messages
+        return yield(0);
+    }
+
+    int unsubscribe(const char *topicFilter) {
+        for (int i = 0; i < num_of_handlers; i++) {
+            if (strcmp(topics[i], topicFilter) == 0) {
+                HostBusUnsubscribe(id, topicFilter);
+                num_of_handlers--;
+                strcpy(topics[i], topics[num_of_handlers]);
+                handlers[i] = handlers[num_of_handlers];
+                break;
+            }
+        }
+        return SUCCESS;
+    }
+
+    int yield(unsigned long timeout_ms = 1000L) {
+        // Messages are handed over as they arrive until the timeout expires
+        uint64_t end_us = HostTime() + (uint64_t)timeout_ms * 1000;
+        Deliver();
+        while (HostTime() < end_us) {
+            HostAdvance(std::min((uint64_t)1000, end_us - HostTime()));
+            Deliver();
+        }
+        return SUCCESS;
+    }
+
+    int disconnect() {
+        while (num_of_handlers > 0) {
+            unsubscribe(topics[0]);
+        }
+        HostBusDisconnect(id);
+        id = -1;
+        return SUCCESS;
+    }
+
+    bool isConnected() {
+        return id >= 0;
+    }
+
+private:
+    void Deliver() {
+        char topic[128];
+        char *payload;
+        size_t length;
+        while (HostBusReceive(id, topic, sizeof(topic), &payload, &length)) {
+            for (int i = 0; i < num_of_handlers; i++) {
+                if (strcmp(topics[i], topic) == 0) {
+                    MQTTString topic_name = {topic};
+                    Message message = {QOS0, false, false, 0, payload, length};
+                    MessageData data(topic_name, message);
+                    handlers[i](data);
+                }
+            }
+            delete[] payload;
+        }
+    }
+
+    int id;
+    int num_of_handlers;
+    char topics[MAX_MESSAGE_HANDLERS][128];
+    messageHandler handlers[MAX_MESSAGE_HANDLERS];
+};
+
+}
+
+#endif
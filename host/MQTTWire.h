@@ -0,0 +1,83 @@
+#ifndef MQTTWIRE_H
+#define MQTTWIRE_H
+
+// MQTT 3.1.1 packets used by the TCP bus in Host.cpp and by the broker of the
+// load test: CONNECT, SUBSCRIBE, UNSUBSCRIBE and PUBLISH with QoS 0, their
+// acknowledgements, PINGREQ and DISCONNECT
+
+#include <stdint.h>
+#include <string>
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_SUBACK 0x90
+#define MQTT_UNSUBSCRIBE 0xA2
+#define MQTT_UNSUBACK 0xB0
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+// Fixed header (type and remaining length) followed by the body
+inline std::string MqttPacket(uint8_t type, const std::string &body) {
+    std::string packet(1, (char)type);
+    size_t length = body.size();
+    do {
+        uint8_t digit = length % 128;
+        length /= 128;
+        packet += (char)((length > 0) ? (digit | 0x80) : (digit));
+    } while (length > 0);
+    return packet + body;
+}
+
+inline std::string MqttString(const std::string &text) {
+    std::string result;
+    result += (char)(text.size() >> 8);
+    result += (char)(text.size() & 0xFF);
+    return result + text;
+}
+
+inline std::string MqttUint16(uint16_t value) {
+    return std::string(1, (char)(value >> 8)) + (char)(value & 0xFF);
+}
+
+// Removes the first whole packet from buffer, false until one has arrived
+inline bool MqttTake(std::string *buffer, uint8_t *type, std::string *body) {
+    size_t length = 0, i = 1;
+    int shift = 0;
+    while (true) {
+        if (i >= buffer->size() || i > 4) {
+            return false;
+        }
+        uint8_t digit = (*buffer)[i++];
+        length |= (size_t)(digit & 0x7F) << shift;
+        shift += 7;
+        if (!(digit & 0x80)) {
+            break;
+        }
+    }
+    if (buffer->size() < i + length) {
+        return false;
+    }
+
+    *type = (*buffer)[0];
+    *body = buffer->substr(i, length);
+    buffer->erase(0, i + length);
+    return true;
+}
+
+inline bool MqttReadString(const std::string &body, size_t *pos, std::string *text) {
+    if (*pos + 2 > body.size()) {
+        return false;
+    }
+    size_t length = ((uint8_t)body[*pos] << 8) | (uint8_t)body[*pos + 1];
+    if (*pos + 2 + length > body.size()) {
+        return false;
+    }
+    *text = body.substr(*pos + 2, length);
+    *pos += 2 + length;
+    return true;
+}
+
+#endif
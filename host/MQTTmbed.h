@@ -0,0 +1,33 @@
+#ifndef MQTTMBED_H
+#define MQTTMBED_H
+
+// Timer used by the Paho client, measured on the virtual clock
+
+#include "mbed.h"
+
+class Countdown {
+public:
+    Countdown() : end_us(HostTime()) {}
+    Countdown(int ms) : end_us(HostTime() + (uint64_t)ms * 1000) {}
+
+    bool expired() {
+        return HostTime() >= end_us;
+    }
+
+    void countdown_ms(unsigned long ms) {
+        end_us = HostTime() + (uint64_t)ms * 1000;
+    }
+
+    void countdown(int seconds) {
+        countdown_ms((unsigned long)seconds * 1000);
+    }
+
+    int left_ms() {
+        return (HostTime() >= end_us) ? (0) : ((int)((end_us - HostTime()) / 1000));
+    }
+
+private:
+    uint64_t end_us;
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef EASY_CONNECT_H
+#define EASY_CONNECT_H
+
+// Network setup helper, on the host the default interface is always available
+
+#include "mbed.h"
+
+inline NetworkInterface *easy_connect(bool log_messages = false) {
+    return NetworkInterface::get_default_instance();
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef FONTS_H
+#define FONTS_H
+
+#include <stdint.h>
+
+// Same layout as the ST fonts. The glyph tables are not part of this
+// repository, so on the host every glyph is blank and text shows up as
+// cells filled with the back color.
+
+typedef struct _tFont {
+    const uint8_t *table;
+    uint16_t Width;
+    uint16_t Height;
+} sFONT;
+
+extern sFONT Font24;
+extern sFONT Font20;
+extern sFONT Font16;
+extern sFONT Font12;
+extern sFONT Font8;
+
+#endif
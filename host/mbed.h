@@ -0,0 +1,166 @@
+#ifndef MBED_H
+#define MBED_H
+
+// Parts of the Mbed OS API used by the game, backed by the virtual clock in Host.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "Host.h"
+
+using namespace std;
+
+class Ticker {
+public:
+    Ticker() : callback(NULL), period_us(0), next_us(0) {}
+    ~Ticker() { detach(); }
+
+    void attach(void (*func)(), float seconds) {
+        attach_us(func, (uint64_t)(seconds * 1000000.0f));
+    }
+
+    void attach_us(void (*func)(), uint64_t us) {
+        detach();
+        callback = func;
+        period_us = us;
+        next_us = HostTime() + us;
+        HostAttachTicker(this);
+    }
+
+    void detach() {
+        HostDetachTicker(this);
+        callback = NULL;
+    }
+
+    void (*callback)();
+    uint64_t period_us;
+    uint64_t next_us;
+};
+
+// Only the touch controller interrupt exists on the host, it is raised when
+// the trace presses the screen
+typedef int PinName;
+#define PC_1 0x21
+
+class InterruptIn {
+public:
+    InterruptIn(PinName pin) {}
+
+    void fall(void (*func)()) {
+        HostAttachTouchInterrupt(func);
+    }
+};
+
+// Interrupt context is a ticker callback or the touch interrupt handler,
+// failed assertions stop the program like MBED_ASSERT() in a debug build
+inline bool core_util_is_isr_active() {
+    return HostInInterrupt();
+}
+
+// Threads take turns on the host, so nothing can run in between
+inline void core_util_critical_section_enter() {
+}
+
+inline void core_util_critical_section_exit() {
+}
+
+#define MBED_ASSERT(expr) \
+    do { \
+        if (!(expr)) { \
+            fprintf(stderr, "Assertion failed: %s, %s:%d\n", #expr, __FILE__, __LINE__); \
+            abort(); \
+        } \
+    } while (0)
+
+#define osWaitForever 0xFFFFFFFFu
+
+class Semaphore {
+public:
+    Semaphore(int32_t count = 0) : tokens(count) {}
+
+    // Virtual time passes until a token is released or the timeout expires
+    int32_t wait(uint32_t millisec = osWaitForever) {
+        uint64_t end_us = (millisec == osWaitForever) ? (UINT64_MAX) : (HostTime() + (uint64_t)millisec * 1000);
+        while (tokens == 0 && HostTime() < end_us) {
+            HostIdle();
+            HostAdvance(min((uint64_t)1000, end_us - HostTime()));
+        }
+        return (tokens > 0) ? (tokens--) : (0);
+    }
+
+    void release() {
+        tokens++;
+    }
+
+private:
+    int32_t tokens;
+};
+
+typedef int osPriority;
+#define osPriorityNormal 24
+#define osPriorityAboveNormal 32
+#define OS_STACK_SIZE 4096
+
+// The priority and stack size are ignored, see HostThreadStart()
+class Thread {
+public:
+    Thread(osPriority priority = osPriorityNormal, uint32_t stack_size = OS_STACK_SIZE) : thread(-1) {}
+
+    int start(void (*task)()) {
+        thread = HostThreadStart(task);
+        return 0;
+    }
+
+    int join() {
+        if (thread >= 0) {
+            HostThreadJoin(thread);
+            thread = -1;
+        }
+        return 0;
+    }
+
+private:
+    int thread;
+};
+
+// Unique ID of the STM32, the simulated board is picked with PLANARITY_DEVICE
+inline uint32_t HAL_GetUIDw0() {
+    return HostDeviceUID(0);
+}
+
+inline uint32_t HAL_GetUIDw1() {
+    return HostDeviceUID(1);
+}
+
+inline uint32_t HAL_GetUIDw2() {
+    return HostDeviceUID(2);
+}
+
+inline uint32_t us_ticker_read() {
+    return (uint32_t)HostTime();
+}
+
+inline void wait(float seconds) {
+    HostAdvance((uint64_t)(seconds * 1000000.0f));
+}
+
+inline void wait_ms(int ms) {
+    HostAdvance((uint64_t)ms * 1000);
+}
+
+inline void wait_us(int us) {
+    HostAdvance(us);
+}
+
+class NetworkInterface {
+public:
+    static NetworkInterface *get_default_instance() {
+        static NetworkInterface network;
+        return &network;
+    }
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef STM32F413H_DISCOVERY_TS_H
+#define STM32F413H_DISCOVERY_TS_H
+
+// Touch screen functions of the STM32F413H-Discovery BSP, replaying the trace in Host.cpp
+
+#include <stdint.h>
+
+#define TS_MAX_NB_TOUCH 2
+
+typedef enum {
+    TS_OK = 0x00,
+    TS_ERROR = 0x01,
+    TS_TIMEOUT = 0x02
+} TS_StatusTypeDef;
+
+typedef struct {
+    uint8_t touchDetected;
+    uint16_t touchX[TS_MAX_NB_TOUCH];
+    uint16_t touchY[TS_MAX_NB_TOUCH];
+    uint8_t touchWeight[TS_MAX_NB_TOUCH];
+    uint8_t touchEventId[TS_MAX_NB_TOUCH];
+    uint8_t touchArea[TS_MAX_NB_TOUCH];
+    uint32_t gestureId;
+} TS_StateTypeDef;
+
+uint8_t BSP_TS_Init(uint16_t ts_SizeX, uint16_t ts_SizeY);
+uint8_t BSP_TS_GetState(TS_StateTypeDef *TS_State);
+
+#endif